@@ -17,14 +17,21 @@
 #ifndef BINMAP_BLOBMAP_HPP
 #define BINMAP_BLOBMAP_HPP
 
+#include "database.hpp"
 #include "graph.hpp"
 #include "metadata.hpp"
+#include "stat_cache.hpp"
 
 #include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/iterator/zip_iterator.hpp>
 
+#include <list>
 #include <ciso646>
 
+class BlobMap;
+class Lock;
+
 template <class G> struct KeyIterator {
   G const &graph_;
   typename G::vertex_iterator iter_;
@@ -112,6 +119,8 @@ public:
 
   boost::shared_ptr<Metadata const> const &metadata() const;
 
+  void metadata(boost::shared_ptr<Metadata const> const &metadata);
+
   Graph const &graph() const;
 
   void graph(Graph const &graph);
@@ -139,6 +148,18 @@ public:
   void predecessors(Graph::successors_type &preds,
                     boost::filesystem::path const &key) const;
 
+  /* dependency cycles: the strongly connected components of more than one
+   * node, dependencies first */
+  void sccs(std::vector<Graph::successors_type> &components) const;
+  /* nodes by layer, the first one holds the nodes without dependencies, the
+   * others the nodes whose dependencies all are in the layers below */
+  void layers(std::vector<Graph::successors_type> &layers) const;
+  /* for each node, the number of nodes that transitively depend on it and
+   * the number of nodes it transitively depends on */
+  void transitive_counts(
+      boost::unordered_map<boost::filesystem::path,
+                           std::pair<size_t, size_t> > &counts) const;
+
   void induced_graph(BlobMapView &pred,
                      boost::filesystem::path const &key) const;
   void induced_successors(BlobMapView &succ,
@@ -148,29 +169,30 @@ public:
 
   template <class F> void filter(F filter, BlobMapView &out) const {
     Graph &ograph = out.graph_;
-    Graph::const_hashes_t hashes = graph_.hashes();
 
     /* populate */
     for (Graph::vertex_iterator iter = graph_.begin(), end = graph_.end();
          iter != end; ++iter) {
-      Hash const &hash = hashes[*iter];
+      Hash const &hash = graph_.hash(*iter);
       MetadataInfo const &md = (*metadata_)[hash];
       boost::filesystem::path const &key = graph_.key(*iter);
       if (filter(key, md, *this) and not ograph.has_node(key)) {
         ograph.add_node(key, hash);
+        std::vector<boost::filesystem::path> vkeys;
         for (Graph::edge_iterator viter = graph_.edge_begin(*iter),
                                   vend = graph_.edge_end(*iter);
              viter != vend; ++viter) {
           Graph::vertex_descriptor v = boost::target(*viter, graph_.graph());
-          Hash const &vhash = hashes[v];
+          Hash const &vhash = graph_.hash(v);
           MetadataInfo const &vmd = (*metadata_)[vhash];
           boost::filesystem::path const &vkey = graph_.key(v);
           if (filter(vkey, vmd, *this)) { // FIXME could be memoized
             if (not ograph.has_node(vkey))
               ograph.add_node(vkey, vhash);
-            ograph.add_edge(key, vkey);
+            vkeys.push_back(vkey);
           }
         }
+        ograph.add_edges(key, vkeys);
       }
     }
   }
@@ -179,12 +201,10 @@ public:
   void project(P project,
                GraphProjection<typename P::result_type> &ograph) const {
 
-    Graph::const_hashes_t hashes = graph_.hashes();
-
     /* populate */
     for (Graph::vertex_iterator iter = graph_.begin(), end = graph_.end();
          iter != end; ++iter) {
-      Hash const &hash = hashes[*iter];
+      Hash const &hash = graph_.hash(*iter);
       MetadataInfo const &md = (*metadata_)[hash];
       typename P::result_type const &key = project(md);
       if (not ograph.has_node(key)) {
@@ -195,7 +215,7 @@ public:
     /* add edges */
     for (Graph::vertex_iterator iter = graph_.begin(), end = graph_.end();
          iter != end; ++iter) {
-      Hash const &hash = hashes[*iter];
+      Hash const &hash = graph_.hash(*iter);
       MetadataInfo const &md = (*metadata_)[hash];
       typename P::result_type const &key = project(md);
 
@@ -203,7 +223,7 @@ public:
                                 vend = graph_.edge_end(*iter);
            viter != vend; ++viter) {
         Graph::vertex_descriptor v = boost::target(*viter, graph_.graph());
-        Hash const &vhash = hashes[v];
+        Hash const &vhash = graph_.hash(v);
         MetadataInfo const &vmd = (*metadata_)[vhash];
         typename P::result_type const &vkey =
             project(vmd); // FIXME potentially costly, could be memoized
@@ -218,6 +238,9 @@ public:
   void diff(BlobMapDiff &diff, BlobMapView const &other) const;
 
   size_t size() const;
+
+protected:
+  void induced(std::vector<bool> const &selected, BlobMapView &out) const;
 };
 
 template <class M> struct MapKeyIterator {
@@ -263,14 +286,14 @@ template <class M> struct MapValueIterator {
   typedef typename std::iterator_traits<typename M::const_iterator>::pointer
   pointer;
 
-  boost::shared_ptr<Metadata const> metadata_;
+  BlobMap const *blobmap_;
   typename M::const_iterator iter_;
 
-  MapValueIterator(boost::shared_ptr<Metadata const> const &metadata,
-                   typename M::const_iterator iter)
-      : metadata_(metadata), iter_(iter) {}
+  MapValueIterator(BlobMap const *blobmap, typename M::const_iterator iter)
+      : blobmap_(blobmap), iter_(iter) {}
 
-  reference operator*() const { return BlobMapView(metadata_, *iter_->second); }
+  // the graph is fetched when needed
+  reference operator*() const;
   MapValueIterator<M> &operator++() {
     ++iter_;
     return *this;
@@ -294,28 +317,82 @@ public:
   typedef std::map<graph_key_type, Graph *> graph_map_t;
 
 private:
-  graph_map_t graphs_;
-  boost::shared_ptr<Metadata> metadata_;
+  /// null for the snapshots of the database that are not pinned
+  mutable graph_map_t graphs_;
+  /// metadata of the graphs above, replaced rather than changed when the
+  /// database completes it, the views built so far keep the former one
+  mutable boost::shared_ptr<Metadata> metadata_;
+  mutable StatCache stat_cache_;
+  hash_algorithm_type hash_algorithm_;
+  database::codec_type codec_;
+  /* native database the snapshots are fetched from */
+  boost::filesystem::path path_;
+  boost::shared_ptr<database::Reader> source_;
+  /// a graph along with the metadata of its files
+  typedef std::pair<boost::shared_ptr<Graph const>,
+                    boost::shared_ptr<Metadata const> > snapshot_type;
+  typedef std::list<std::pair<graph_key_type, snapshot_type> > cache_type;
+  /// most recently used first, each snapshot fetched from the database has
+  /// its own metadata, dropped along with it
+  mutable cache_type fetched_;
+  mutable bool stat_cache_fetched_;
+  bool stat_cache_changed_;
+  bool rewrite_; /// set if the database cannot just be appended to
+  size_t cache_size_;
+  boost::scoped_ptr<Lock> lock_;
 
 public:
   BlobMap();
+  /** opens a database, the snapshots of a native one and the metadata of
+   * their files are only read when first needed */
   BlobMap(boost::filesystem::path const &);
   ~BlobMap();
 
+  /** metadata of the files of the snapshots created or pinned, and of the
+   * stat cache once read. The snapshots fetched from the database only
+   * have their own, which at() gives to the view */
   boost::shared_ptr<Metadata const> metadata() const;
 
   boost::shared_ptr<Metadata> metadata();
 
+  /** analysis results of the files from the most recent incremental scan */
+  StatCache const &stat_cache() const;
+  StatCache &stat_cache();
+  /** reads the stat cache and the metadata it brings from the database now,
+   * instead of when first needed */
+  void load_stat_cache() const;
+
+  /** algorithm of all the file hashes, sha1 for databases that predate the
+   * choice */
+  hash_algorithm_type hash_algorithm() const;
+  void hash_algorithm(hash_algorithm_type algorithm);
+
+  /** codec the sections written by store() are compressed with, none by
+   * default */
+  database::codec_type codec() const;
+  void codec(database::codec_type codec);
+
   bool empty() const;
 
   Graph &create(graph_key_type const &key);
 
+  /** writes the blobmap to \p archive_path, only appending what is new if
+   * it is the database the blobmap was read from */
   void store(boost::filesystem::path const &archive_path);
 
+  /** number of snapshots fetched from the database kept in memory, the
+   * least recently used one is dropped beyond */
+  size_t cache_size() const;
+  void cache_size(size_t size);
+
   graph_key_type const &back_key() const;
-  Graph const &operator[](graph_key_type const &key) const;
+  /** a snapshot fetched from the database stays valid as long as the
+   * returned pointer is held, even once dropped from the cache */
+  boost::shared_ptr<Graph const> operator[](graph_key_type const &key) const;
+  /** a snapshot fetched from the database is pinned in memory from then on */
   Graph &operator[](graph_key_type const &key);
 
+  /** sets the graph of \p bmv, and the metadata of its files */
   void back(BlobMapView &bmv) const;
   void at(BlobMapView &bmv, graph_key_type const &key) const;
 
@@ -341,7 +418,16 @@ public:
   }
 
 protected:
-  void fetch_(graph_key_type const &) const;
+  snapshot_type snapshot_(graph_key_type const &) const;
+  snapshot_type fetch_(graph_key_type const &) const;
+  void fetch_stat_cache_() const;
 };
 
+template <class M>
+typename MapValueIterator<M>::reference MapValueIterator<M>::operator*() const {
+  BlobMapView view(blobmap_->metadata());
+  blobmap_->at(view, iter_->first);
+  return view;
+}
+
 #endif
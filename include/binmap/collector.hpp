@@ -18,11 +18,14 @@
 #define BINMAP_DEPENDENCY_ANALYZER_HPP
 
 #include "binmap/metadata.hpp"
+#include "binmap/file_content.hpp"
 
 #include <string>
 #include <set>
 #include <memory>
+#include <boost/shared_ptr.hpp>
 #include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
 
 /// \brief A collector collects dependencies and metadata for a given type
 /// Derive from this class to implement a collector for a given file type
@@ -31,9 +34,17 @@ class Collector {
 public:
 
   virtual ~Collector();
-  /// \brief Initialize collector for given \p path
+  /// \brief Initialize collector for given \p path, whose type, without
+  /// following symlinks, is \p status.
+  /// \p content holds the bytes of regular files, it is null for other types
+  /// or if the file could not be read. Collectors read the file through it
+  /// rather than opening it again, and keep a reference if they need it after
+  /// initialization.
   /// returns false if initialization fails
-  virtual bool initialize(boost::filesystem::path const &path) = 0;
+  virtual bool
+  initialize(boost::filesystem::path const &path,
+             boost::filesystem::file_status const &status,
+             boost::shared_ptr<FileContent const> const &content) = 0;
 
   /// \brief Fills \p deps with the absolute path of the dependencies.
   virtual void operator()(std::set<boost::filesystem::path> &deps) = 0;
@@ -41,13 +52,64 @@ public:
   /// \brief Fills \p base with the metadata.
   virtual void operator()(MetadataInfo &mi) = 0;
 
+  /// \brief Tells whether the dependencies found by the collector do not
+  /// depend on the location of the file, so that they also hold for any copy
+  /// of it. Defaults to false.
+  virtual bool relocatable() const;
+
   /// \brief Lazily scans available collectors for one capable to handle \p path
   /// according to Collector::ty_new
   static std::auto_ptr<Collector> get_collector(boost::filesystem::path const &path);
 
+  /// \brief Same as above, when the type of \p path is already known
+  /// Only the collectors whose Signature matches are initialized.
+  static std::auto_ptr<Collector>
+  get_collector(boost::filesystem::path const &path,
+                boost::filesystem::file_status const &status);
+
+  /// \brief Same as above, \p content being the content of \p path if it is
+  /// a regular file, as shared with the caller
+  static std::auto_ptr<Collector>
+  get_collector(boost::filesystem::path const &path,
+                boost::filesystem::file_status const &status,
+                boost::shared_ptr<FileContent const> const &content);
+
+  /// \brief Reads the first bytes of \p path, as needed to check the
+  /// signatures. Only regular files are read.
+  static std::string read_header(boost::filesystem::path const &path,
+                                 boost::filesystem::file_status const &status);
+
+  /// \brief Cheaply tells whether some collector may handle a file of type
+  /// \p status starting with \p header, without initializing any
+  static bool may_handle(boost::filesystem::file_status const &status,
+                         std::string const &header);
+
+  /// \brief Number of leading bytes of a regular file read to check the
+  /// signatures
+  static const size_t HEADER_SIZE = 4096;
+
+  /// \brief Cheap test performed before creating a collector: the type of the
+  /// file, symlinks not followed, and optionally some magic bytes
+  struct Signature {
+    boost::filesystem::file_type type;
+    std::string magic;
+    size_t offset;
+
+    Signature(boost::filesystem::file_type type,
+              std::string const &magic = std::string(), size_t offset = 0);
+
+    /// \brief True if a file of type \p status starting with \p header may
+    /// be handled
+    bool matches(boost::filesystem::file_status const &status,
+                 std::string const &header) const;
+  };
+
   /// \brief Adds \p collector to the pool of existing collectors
+  /// Collectors registered without a Signature are tried on every file.
   struct Register {
     Register(std::auto_ptr<Collector>(*collector)());
+    Register(std::auto_ptr<Collector>(*collector)(),
+             Signature const &signature);
   };
 };
 
@@ -20,10 +20,11 @@
 #include "binmap/collectors/pe.hpp"
 
 #include <map>
+#include <istream>
 
 template <typename _Bits> class PeData {
 private:
-  std::ifstream &_file;
+  std::istream &_file;
 
   PeDosHeader _dos_header;
   PeNtHeadersTraits<_Bits> _nt_headers;
@@ -32,7 +33,7 @@ private:
 public:
   typedef PeNtHeadersTraits<_Bits> PeNtHeaders;
 
-  PeData(std::ifstream &file);
+  PeData(std::istream &file);
   virtual ~PeData();
 
   const PeDosHeader &dos_header(void) const { return _dos_header; }
@@ -55,21 +55,21 @@ struct PEDecoder {
 
   virtual void extract_hardening_features(MetadataInfo&) const = 0;
 
-  static uint16_t machine_type(std::ifstream &file);
+  static uint16_t machine_type(std::istream &file);
 };
 
 /* Used to create PEDecoder instances from a given PE file path.*/
 PEDecoder *PeDecoderFactory(boost::filesystem::path const &path,
                             bool full_parsing = false);
-/* Used to create PEDecoder instances from a given PE file path */
-PEDecoder *PeDecoderFactory(std::ifstream &file, bool full_parsing = false);
+/* Used to create PEDecoder instances from a seekable stream over a PE file */
+PEDecoder *PeDecoderFactory(std::istream &file, bool full_parsing = false);
 
 template <typename _Bits> class pe_decoder : public PEDecoder {
 public:
   typedef PeNtHeadersTraits<_Bits> PeNtHeaders;
   typedef PeImageLoadConfigDirectoryTraits<_Bits> PeImageLoadConfigDirectory;
 
-  pe_decoder(std::ifstream &file, bool full_parsing = false);
+  pe_decoder(std::istream &file, bool full_parsing = false);
 
   bool is_compatible(void) const;
   uint16_t machine_type(void) const;
@@ -93,7 +93,7 @@ public:
 
 private:
   PeData<_Bits> _pe_data;
-  std::ifstream &_file;
+  std::istream &_file;
   bool _is_compatible;
   uint16_t _machine_type;
   std::map<std::string, boost::filesystem::path> _assembly_maps;
@@ -0,0 +1,92 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef BINMAP_COMPACT_GRAPH_HPP
+#define BINMAP_COMPACT_GRAPH_HPP
+
+#include "binmap/hash.hpp"
+#include "binmap/path_table.hpp"
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/filesystem/path.hpp>
+#include <boost/graph/compressed_sparse_row_graph.hpp>
+
+/// \brief Immutable form of a dependency graph
+///
+/// The out-edges and in-edges are held as compressed sparse rows, the paths
+/// of the vertices as PathTable identifiers and their hashes in parallel
+/// arrays. Paths are looked up through the vertices sorted by identifier.
+class CompactGraph {
+public:
+  typedef boost::compressed_sparse_row_graph<
+      boost::bidirectionalS, boost::no_property, boost::no_property,
+      boost::no_property, unsigned, unsigned> graph_type;
+  typedef graph_type::vertex_descriptor vertex_descriptor;
+
+private:
+  graph_type graph_;
+  std::vector<path_id> paths_;            /// path of each vertex
+  std::vector<Hash> hashes_;              /// hash of each vertex
+  std::vector<vertex_descriptor> sorted_; /// vertices, sorted by path
+
+public:
+  /// \brief Copies \p graph, a boost graph whose vertex descriptors are
+  /// indices, the path_id of its vertices are given by \p names and their
+  /// hashes by \p hashes
+  template <class G, class NameMap, class HashMap>
+  CompactGraph(G const &graph, NameMap names, HashMap hashes);
+
+  /// \brief Builds a graph whose vertex v is named \p paths[v] and hashed
+  /// \p hashes[v], with an edge for each element of \p edges. Takes the
+  /// content of \p paths and \p hashes
+  CompactGraph(std::vector<path_id> &paths, std::vector<Hash> &hashes,
+               std::vector<std::pair<unsigned, unsigned> > const &edges);
+
+  graph_type const &graph() const { return graph_; }
+
+  size_t size() const { return hashes_.size(); }
+
+  boost::filesystem::path key(vertex_descriptor v) const;
+
+  path_id id(vertex_descriptor v) const { return paths_[v]; }
+
+  Hash const &hash(vertex_descriptor v) const { return hashes_[v]; }
+
+  /// \brief Sets \p v to the vertex of \p key, returns false if there is none
+  bool find(boost::filesystem::path const &key, vertex_descriptor &v) const;
+  bool find(path_id key, vertex_descriptor &v) const;
+
+private:
+  void index();
+};
+
+template <class G, class NameMap, class HashMap>
+CompactGraph::CompactGraph(G const &graph, NameMap names, HashMap hashes)
+    : graph_(graph, get(boost::vertex_index, graph)) {
+  size_t const size = num_vertices(graph);
+  paths_.reserve(size);
+  hashes_.reserve(size);
+  typename boost::graph_traits<G>::vertex_iterator iter, end;
+  for (boost::tie(iter, end) = vertices(graph); iter != end; ++iter) {
+    paths_.push_back(get(names, *iter));
+    hashes_.push_back(get(hashes, *iter));
+  }
+  index();
+}
+
+#endif
@@ -0,0 +1,108 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef BINMAP_CONDENSATION_HPP
+#define BINMAP_CONDENSATION_HPP
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+
+/// \brief Strongly connected components of a directed graph, and the DAG
+/// they form.
+///
+/// Components are numbered in topological order: a component only has
+/// successors with a greater number. They are also split in layers, a
+/// component with no successor is in layer 0, the other ones one layer above
+/// their highest successor. For a dependency graph, a layer only depends on
+/// the layers below.
+class Condensation {
+public:
+  typedef std::vector<unsigned>::const_iterator iterator;
+  typedef std::pair<iterator, iterator> range_type;
+
+private:
+  std::vector<unsigned> component_;         /// component of each vertex
+  std::vector<size_t> member_offsets_;      /// first member of each component
+  std::vector<unsigned> members_;           /// vertices, by component
+  std::vector<size_t> successor_offsets_;   /// first successor of each one
+  std::vector<unsigned> successors_;        /// components, without duplicates
+  std::vector<unsigned> layer_;             /// layer of each component
+  std::vector<size_t> layer_offsets_;       /// first component of each layer
+  std::vector<unsigned> layered_;           /// components, by layer
+
+public:
+  /// \brief Condenses \p graph, a boost graph whose vertex descriptors are
+  /// indices
+  template <class G> explicit Condensation(G const &graph);
+
+  /// \brief Number of components
+  size_t size() const { return layer_.size(); }
+
+  /// \brief Number of vertices of the condensed graph
+  size_t vertex_count() const { return component_.size(); }
+
+  unsigned component(size_t vertex) const { return component_[vertex]; }
+
+  /// \brief Vertices of component \p c
+  range_type members(unsigned c) const;
+
+  /// \brief Components \p c has an edge toward
+  range_type successors(unsigned c) const;
+
+  unsigned layer(unsigned c) const { return layer_[c]; }
+
+  size_t layer_count() const { return layer_offsets_.size() - 1; }
+
+  /// \brief Components of layer \p l
+  range_type layer_members(size_t l) const;
+
+  /// \brief Sets \p descendants to the number of vertices reachable from
+  /// each component and \p ancestors to the number of vertices each one is
+  /// reachable from, its own vertices included
+  void closure_sizes(std::vector<size_t> &descendants,
+                     std::vector<size_t> &ancestors) const;
+
+private:
+  void build(std::vector<unsigned> const &component, size_t count,
+             std::vector<std::vector<unsigned> > const &edges);
+};
+
+#include <boost/graph/graph_traits.hpp>
+#include <boost/graph/strong_components.hpp>
+
+template <class G> Condensation::Condensation(G const &graph) {
+  size_t const size = num_vertices(graph);
+  std::vector<unsigned> component(size);
+  size_t const count =
+      size == 0 ? 0 : boost::strong_components(
+                          graph, boost::make_iterator_property_map(
+                                     component.begin(),
+                                     get(boost::vertex_index, graph)));
+
+  /* edges between components */
+  std::vector<std::vector<unsigned> > successors(count);
+  typename boost::graph_traits<G>::edge_iterator iter, end;
+  for (boost::tie(iter, end) = edges(graph); iter != end; ++iter) {
+    unsigned const from = component[source(*iter, graph)],
+                   to = component[target(*iter, graph)];
+    if (from != to)
+      successors[from].push_back(to);
+  }
+  build(component, count, successors);
+}
+
+#endif
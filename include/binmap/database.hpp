@@ -0,0 +1,220 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef BINMAP_DATABASE_HPP
+#define BINMAP_DATABASE_HPP
+
+#include "binmap/hash.hpp"
+#include "binmap/path_table.hpp"
+
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <cstddef>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/unordered_map.hpp>
+
+class BlobMap;
+class FileContent;
+class Graph;
+class Metadata;
+class StatCache;
+
+/// \brief Native binary format of the databases
+///
+/// A database starts with a header: the magic ``BINMAPDB'', the format
+/// version and the offset of the section table, which lists the tag, flags,
+/// offset and size of each section. Integers are little endian, the counts
+/// and indices inside the sections are LEB128 varints.
+///
+/// Sections, each one only referring to the ones before it:
+/// - STRS, the strings: names, versions, symbols, errors and path components,
+///   after a table of their offsets,
+/// - PATH, the paths as a trie of fixed size (parent, component) entries, 0
+///   being the empty path,
+/// - HASH, the hash algorithm then the raw digests,
+/// - SNAP, a snapshot in full: path and hash of each vertex, then the
+///   out-edges as compressed sparse rows,
+/// - DELT, a snapshot as the changes from an earlier one: the time stamp of
+///   that one, the vertices removed and added, the hashes changed, then the
+///   edges removed and added,
+/// - META, the metadata of a range of hashes, after a table of their offsets,
+/// - STAT, the stat cache of the last incremental scan,
+/// - CTLG, the catalog: time stamp and section of each snapshot.
+///
+/// Consecutive snapshots mostly share their files, so a snapshot is usually
+/// written as a delta against the previous one. A full one is still written
+/// every few snapshots, which bounds the deltas applied to decode one.
+///
+/// STRS, PATH, HASH and META may be split in several sections, the entries
+/// of each STRS, PATH and HASH one being numbered after the ones of the
+/// previous sections. This lets a scan append its snapshot and the entries
+/// it needs after the existing sections, then a new section table, and only
+/// then point the header to the new table. The last CTLG and STAT sections
+/// supersede the previous ones.
+///
+/// The low byte of the flags of a section names the codec it is compressed
+/// with, if any: a compressed section holds its size once decompressed, then
+/// its head left plain, the counts of a dictionary or the time stamp a delta
+/// refers to, then the compressed rest. Each section is compressed on its
+/// own, so that only the ones needed are decompressed: opening a database
+/// decompresses nothing but the catalog.
+///
+/// Everything but the stat cache can be decoded piecewise, see Reader.
+/// Readers skip the sections they do not know, and reject databases whose
+/// version is greater than theirs.
+namespace database {
+
+boost::uint32_t const VERSION = 1;
+
+/// \brief Codecs the sections may be compressed with
+enum codec_type { no_codec = 0, deflate_codec = 1 };
+
+/// \brief True if the \p size bytes at \p data start like a native database
+bool is_native(char const *data, size_t size);
+
+/// \brief Writes \p blobmap to \p out in the native format
+void write(std::ostream &out, BlobMap const &blobmap);
+
+/// \brief Writes \p blobmap in the native format to a temporary file, syncs
+/// it, then renames it to \p path
+void replace(boost::filesystem::path const &path, BlobMap const &blobmap);
+
+class Reader;
+
+/// \brief Appends to the native database \p path, opened as \p base, the
+/// snapshots of \p blobmap it lacks and the metadata of their new hashes,
+/// as well as the stat cache if \p stat_cache is set
+void append(boost::filesystem::path const &path, Reader &base,
+            BlobMap const &blobmap, bool stat_cache);
+
+/// \brief Native database opened for reading, each snapshot and the metadata
+/// of its files being decoded on demand
+///
+/// Opening only reads the section table, the catalog and the counts of the
+/// dictionaries, the other sections are decompressed when first needed. Methods
+/// throw std::runtime_error if the database turns out to be malformed.
+class Reader {
+public:
+  struct Section {
+    char const *data;
+    size_t size;
+
+    Section() : data(0), size(0) {}
+    Section(char const *data, size_t size) : data(data), size(size) {}
+  };
+
+  /// \brief The entries [first, first + size) of a table, held by section
+  /// number \p section from its byte \p offset on
+  struct Segment {
+    size_t section;
+    size_t offset;
+    size_t first;
+    size_t size;
+  };
+
+private:
+  boost::shared_ptr<FileContent const> content_;
+  std::vector<std::pair<boost::uint32_t, Section> > sections_; /// the table
+  std::vector<boost::uint32_t> flags_; /// codec of each section
+  /// compressed sections once decompressed
+  mutable std::vector<boost::shared_ptr<std::string> > decoded_;
+  std::vector<Segment> strings_, paths_, hashes_, metadata_;
+  size_t stats_; /// the section of the stat cache, if any
+  std::map<time_t, size_t> snapshots_; /// section of each snapshot
+  hash_algorithm_type hash_algorithm_;
+  size_t string_count_, path_count_, hash_count_;
+  std::vector<path_id> path_ids_;     /// interned paths, root until resolved
+  std::vector<bool> loaded_metadata_; /// metadata already decoded, by hash
+  /* indices of the paths and hashes decoded so far, and of the entries
+   * found by index() */
+  boost::unordered_map<path_id, size_t> path_indices_;
+  boost::unordered_map<Hash, size_t> hash_indices_;
+  boost::unordered_map<std::string, size_t> string_indices_;
+
+  Reader(Reader const &);
+  Reader &operator=(Reader const &);
+
+public:
+  explicit Reader(boost::shared_ptr<FileContent const> const &content);
+
+  hash_algorithm_type hash_algorithm() const { return hash_algorithm_; }
+
+  /// \brief Time stamps of the snapshots, in increasing order
+  void keys(std::vector<time_t> &keys) const;
+
+  bool has(time_t key) const;
+
+  /// \brief Number of deltas to apply to decode the snapshot \p key, 0 if
+  /// it is stored in full
+  size_t delta_depth(time_t key) const;
+
+  /// \brief Loads the snapshot \p key in \p graph, frozen, and the metadata of
+  /// its hashes in \p metadata, meant to be the snapshot's own: it is decoded
+  /// again for each call
+  void graph(time_t key, Graph &graph, Metadata &metadata);
+
+  /// \brief Loads in \p metadata the metadata this method and stat_cache()
+  /// did not load yet
+  void metadata(Metadata &metadata);
+
+  /// \brief Loads the stat cache in \p cache, and the metadata it refers to
+  /// in \p metadata
+  void stat_cache(StatCache &cache, Metadata &metadata);
+
+  size_t string_count() const { return string_count_; }
+  size_t path_count() const { return path_count_; }
+  size_t hash_count() const { return hash_count_; }
+
+  /// \brief Looks for \p paths, their parent directories, \p hashes and
+  /// \p strings in the database, so that the find methods know the ones it
+  /// holds. Only these entries are resolved, not the whole dictionaries
+  void index(std::vector<path_id> const &paths,
+             std::vector<Hash> const &hashes,
+             std::vector<std::string> const &strings);
+
+  /// \brief Sets \p index to the index of \p id in the database, returns
+  /// false if it is not there or was neither decoded nor looked for by
+  /// index()
+  bool find_path(path_id id, size_t &index) const;
+  bool find_hash(Hash const &hash, size_t &index) const;
+  bool find_string(std::string const &value, size_t &index) const;
+
+  /// \brief True if the database holds the metadata of hash \p index
+  bool has_metadata(size_t index) const;
+
+private:
+  size_t raw_size(size_t index) const;
+  Section head(size_t index) const;
+  Section section(size_t index) const;
+  Section section(Segment const &segment) const;
+  void chain(time_t key, std::vector<size_t> &sections) const;
+  std::string string(size_t index) const;
+  path_id path(size_t index);
+  Hash hash(size_t index) const;
+  void load_metadata(size_t index, Metadata &metadata);
+  void decode_metadata(size_t index, Metadata &metadata);
+
+  friend void append(boost::filesystem::path const &path, Reader &base,
+                     BlobMap const &blobmap, bool stat_cache);
+};
+}
+
+#endif
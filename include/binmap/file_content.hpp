@@ -0,0 +1,121 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef BINMAP_FILE_CONTENT_HPP
+#define BINMAP_FILE_CONTENT_HPP
+
+#include <vector>
+#include <istream>
+#include <streambuf>
+#include <cstddef>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/path.hpp>
+
+/// \brief The content of a file, read once and shared by the hash and the
+/// collectors.
+///
+/// Small files are read in a buffer. Large files are kept open and read on
+/// demand through read(), only their first bytes are held in memory: mapping
+/// them would raise SIGBUS on access if they were truncated meanwhile, unless
+/// this process owns them.
+class FileContent {
+public:
+  enum access_type {
+    safe_access,  ///< read large files on demand
+    mapped_access ///< map large files, for files this process owns
+  };
+
+private:
+  char const *data_;
+  size_t size_;
+  boost::uint64_t length_;
+  bool mapped_;
+  bool streamed_;
+  bool good_;
+  std::vector<char> buffer_;
+  boost::filesystem::path path_;
+  access_type access_;
+  bool partial_; // set while only the first bytes have been read
+  int fd_;       // kept open meanwhile, or as long as the content is streamed
+  boost::uint64_t device_, inode_;
+
+  FileContent(FileContent const &);
+  FileContent &operator=(FileContent const &);
+
+  void read_(size_t limit);
+  bool fill_(size_t limit, size_t file_size);
+  void close_();
+
+public:
+  /// \brief Opens, maps or reads, and closes \p path, unless it is read on
+  /// demand
+  explicit FileContent(boost::filesystem::path const &path,
+                       access_type access = safe_access);
+  /// \brief Opens \p path and reads its first \p limit bytes only, the rest
+  /// is read by complete(), on the same descriptor
+  FileContent(boost::filesystem::path const &path, size_t limit,
+              access_type access = safe_access);
+  /// \brief Takes over the content read in \p buffer, left empty
+  explicit FileContent(std::vector<char> &buffer);
+  ~FileContent();
+
+  /// \brief Reads the rest of a file opened with a limit, returns good()
+  bool complete();
+
+  /// \brief False if the file could not be read, the content is empty then
+  bool good() const { return good_; }
+
+  /// \brief Bytes held in memory: the whole content, or only its first bytes
+  /// if streamed()
+  char const *data() const { return data_; }
+  size_t size() const { return size_; }
+
+  /// \brief Set if the content past size() is read on demand
+  bool streamed() const { return streamed_; }
+  /// \brief Size of the whole content
+  boost::uint64_t length() const { return length_; }
+
+  /// \brief Copies up to \p count bytes from \p offset in the content to
+  /// \p buffer, returns the number of bytes copied. Safe to call from several
+  /// threads at once
+  size_t read(boost::uint64_t offset, char *buffer, size_t count) const;
+
+  /// \brief Identity of the file read, both are 0 when unknown
+  boost::uint64_t device() const { return device_; }
+  boost::uint64_t inode() const { return inode_; }
+};
+
+/// \brief Seekable input stream over a FileContent, which must outlive it.
+/// The content read on demand goes through a buffer of the stream
+class ContentStream : public std::istream {
+  struct Buffer : std::streambuf {
+    FileContent const &content_;
+    boost::uint64_t offset_; // offset in the content of eback()
+    std::vector<char> chunk_;
+
+    explicit Buffer(FileContent const &content);
+    int_type underflow();
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                     std::ios_base::openmode which);
+    pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+  };
+  Buffer buffer_;
+
+public:
+  explicit ContentStream(FileContent const &content);
+};
+
+#endif
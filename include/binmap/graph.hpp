@@ -18,8 +18,14 @@
 #define BINMAP_GRAPH_HPP
 
 #include "binmap/hash.hpp"
+#include "binmap/compact_graph.hpp"
+#include "binmap/path_table.hpp"
 
 #include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/range/begin.hpp>
+#include <boost/range/end.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/unordered_set.hpp>
 
@@ -30,6 +36,7 @@
 #include <boost/graph/adj_list_serialize.hpp>
 #include <boost/serialization/string.hpp>
 #include <boost/serialization/map.hpp>
+#include <boost/serialization/split_member.hpp>
 #include "boost_ex/filesystem/serialization.hpp"
 #include "boost_ex/serialization/unordered_map.hpp"
 #include "boost_ex/serialization/unordered_set.hpp"
@@ -42,28 +49,52 @@ enum vertex_hash_t {
 BOOST_INSTALL_PROPERTY(vertex, hash);
 }
 
+class Condensation;
+class Reachability;
+
+/** Dependency graph of a scan
+ *
+ * A graph is built node by node, then frozen into a CompactGraph once it is
+ * complete. The compact form is also built, and kept until the next change,
+ * the first time the edges of a graph being built are traversed.
+ */
 class Graph {
 
-  typedef boost::property<boost::vertex_name_t, boost::filesystem::path,
+  /* vertices are named by their path_id, archives hold the paths */
+  typedef boost::property<boost::vertex_name_t, path_id,
                           boost::property<boost::vertex_hash_t, Hash> >
   vertex_property;
   typedef boost::adjacency_list<boost::vecS, boost::vecS, boost::bidirectionalS,
-                                vertex_property> graph_type;
-
-  graph_type graph_;
-  boost::unordered_map<boost::filesystem::path, graph_type::vertex_descriptor>
-  mapping_;
-  mutable std::vector<int> *distance_matrix_;
-
-  boost::unordered_set<boost::filesystem::path> visited_path_;
+                                vertex_property> mutable_graph_type;
+  typedef boost::property<boost::vertex_name_t, boost::filesystem::path,
+                          boost::property<boost::vertex_hash_t, Hash> >
+  archive_vertex_property;
+  typedef boost::adjacency_list<boost::vecS, boost::vecS, boost::bidirectionalS,
+                                archive_vertex_property> archive_graph_type;
+  typedef boost::unordered_map<boost::filesystem::path,
+                               archive_graph_type::vertex_descriptor>
+  archive_mapping_type;
+
+  mutable_graph_type graph_;
+  boost::unordered_map<path_id, mutable_graph_type::vertex_descriptor> mapping_;
+  mutable boost::shared_ptr<CompactGraph const> compact_;
+  bool frozen_;
+  /* built on the first has_path, dropped when the graph changes */
+  mutable boost::shared_ptr<Reachability const> reachability_;
+  /* built on first use as well, reachability is computed from it */
+  mutable boost::shared_ptr<Condensation const> condensation_;
+
+  /* nodes by lower-cased filename, in step with mapping_: the first node
+   * found in a directory, and the nodes of unresolved dependencies */
+  typedef boost::unordered_map<std::string, path_id> name_index_type;
+  name_index_type resolved_;
+  boost::unordered_map<std::string, std::vector<path_id> > unresolved_;
 
 public:
   Graph();
-  ~Graph();
 
+  typedef CompactGraph::graph_type graph_type;
   typedef boost::unordered_set<boost::filesystem::path> successors_type;
-  typedef boost::property_map<graph_type, boost::vertex_hash_t>::const_type
-  const_hashes_t;
   typedef boost::graph_traits<graph_type>::vertex_iterator vertex_iterator;
   typedef vertex_iterator iterator;
   typedef graph_type::vertex_descriptor vertex_descriptor;
@@ -79,17 +110,35 @@ public:
 *		=> return path parsed before
 *	if `input_file` is found but hasn't been found before
 *		=> return `input_file` (and change the node's name)
+*	filenames are compared case-insensitively
 **/
   boost::filesystem::path add_node(boost::filesystem::path const &input_file,
                 Hash const &input_hash);
 
+  /** get the compact form of the graph */
   graph_type const &graph() const;
 
+  /** drop everything but the compact form, the graph is not meant to change
+   * anymore. It can still change, at the cost of a conversion */
+  void freeze();
+
+  /** replace the graph by compact, frozen */
+  void freeze(boost::shared_ptr<CompactGraph const> const &compact);
+
+  bool frozen() const;
+
+  /** get the node descriptor associated to a filename, throws
+   * std::out_of_range if there is none */
+  vertex_descriptor vertex(boost::filesystem::path const &key) const;
+
   /** get the filename associated to a node descriptor */
-  boost::filesystem::path const &key(graph_type::vertex_descriptor vd) const;
+  boost::filesystem::path key(vertex_descriptor vd) const;
+
+  /** get the path_id associated to a node descriptor */
+  path_id id(vertex_descriptor vd) const;
 
   /** get the hash associated to a node descriptor */
-  Hash const &hash(graph_type::vertex_descriptor vd) const;
+  Hash const &hash(vertex_descriptor vd) const;
 
   /** get the hash associated to a filename */
   Hash const &hash(boost::filesystem::path const &key) const;
@@ -100,9 +149,6 @@ public:
   void predecessors(successors_type &preds,
                     boost::filesystem::path const &key) const;
 
-  /** get internal filename to hash dict */
-  const_hashes_t hashes() const;
-
   /** iterates over vertices */
   vertex_iterator begin() const;
 
@@ -113,26 +159,78 @@ public:
 
   edge_iterator edge_end(boost::filesystem::path const &input_file) const;
 
-  edge_iterator edge_begin(graph_type::vertex_descriptor input) const;
+  edge_iterator edge_begin(vertex_descriptor input) const;
 
-  edge_iterator edge_end(graph_type::vertex_descriptor input) const;
+  edge_iterator edge_end(vertex_descriptor input) const;
 
-  /** add edge between from and to, pointing toward to*/
+  /** add edge between from and to, pointing toward to. from must be a node
+   * of the graph, std::out_of_range is thrown otherwise. to is added as a
+   * node, hashed with algorithm, if it is not one */
   void add_edge(boost::filesystem::path const &from,
-                boost::filesystem::path const &to);
+                boost::filesystem::path const &to,
+                hash_algorithm_type algorithm = sha1_algorithm);
+
+  /** add edges from from toward each path of to, as add_edge does. The
+   * missing targets are added as nodes in bulk, edges already in the graph
+   * and loops are skipped. Like add_node, it must not run concurrently with
+   * other changes of the graph */
+  void add_edges(boost::filesystem::path const &from,
+                 std::vector<boost::filesystem::path> const &to,
+                 hash_algorithm_type algorithm = sha1_algorithm);
+
+  template <class Range>
+  void add_edges(boost::filesystem::path const &from, Range const &to,
+                 hash_algorithm_type algorithm = sha1_algorithm) {
+    add_edges(from,
+              std::vector<boost::filesystem::path>(boost::begin(to),
+                                                   boost::end(to)),
+              algorithm);
+  }
+
+  /** get the strongly connected components of the graph, computed once */
+  Condensation const &condensation() const;
 
-  /** dump the graph as a .dot file */
-  void dot(boost::filesystem::path const &path) const;
+  /** get the number of nodes each node transitively depends on, and the
+   * number of nodes that transitively depend on it, by node descriptor */
+  void transitive_counts(std::vector<size_t> &predecessors,
+                         std::vector<size_t> &successors) const;
+
+  /** dump the graph as a .dot file, with the transitive counts of each
+   * node if counts is set */
+  void dot(boost::filesystem::path const &path, bool counts = false) const;
 
   size_t size() const;
 
+  /* graphs are archived with their paths, in the format of the first
+   * versions */
   template < class Archive >
-  void serialize(Archive & ar, unsigned int) {
-      ar& graph_ & mapping_;
+  void save(Archive & ar, unsigned int) const {
+      archive_graph_type graph;
+      archive_mapping_type mapping;
+      archive(graph, mapping);
+      ar & graph & mapping;
   }
 
+  template < class Archive >
+  void load(Archive & ar, unsigned int) {
+      archive_graph_type graph;
+      archive_mapping_type mapping;
+      ar & graph & mapping;
+      restore(graph);
+  }
+
+  BOOST_SERIALIZATION_SPLIT_MEMBER()
+
 protected:
-  void compute_distance_matrix() const;
+  void archive(archive_graph_type &graph, archive_mapping_type &mapping) const;
+  void restore(archive_graph_type const &graph);
+  CompactGraph const &compact() const;
+  void thaw();
+  void changed();
+  void compute_reachability() const;
+  bool unresolved(path_id id) const;
+  void index(path_id id);
+  void clear_index();
 };
 
 /** Class resulting from the projection of a graph to a new dimension */
@@ -0,0 +1,105 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef BINMAP_GRAPH_BUILDER_HPP
+#define BINMAP_GRAPH_BUILDER_HPP
+
+#include "binmap/hash.hpp"
+#include "binmap/path_table.hpp"
+
+#include <vector>
+#include <utility>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+
+class Graph;
+class Lock;
+
+/// \brief Collects the nodes and edges of a Graph from several threads
+///
+/// Nodes are numbered from a shared counter as they are first seen, in a
+/// path_id to node map split in shards that each have their own lock, so
+/// threads only contend when they touch the same shard. Edges go to a Buffer
+/// owned by the thread that adds them, and are handed over to the builder
+/// once, under its lock.
+///
+/// Nothing is resolved while collecting: merge() inserts everything in a
+/// Graph at once, nodes ordered by path then edges grouped by source, so that
+/// the result does not depend on the scheduling of the threads.
+class GraphBuilder {
+public:
+  typedef boost::uint32_t node_type;
+
+private:
+  typedef std::vector<std::pair<node_type, node_type> > edges_type;
+
+public:
+  /// \brief Edges added by a single thread, without any lock. They are
+  /// handed over to the builder by flush(), or when the buffer is destroyed
+  class Buffer {
+    GraphBuilder &builder_;
+    edges_type edges_;
+
+    Buffer(Buffer const &);
+    Buffer &operator=(Buffer const &);
+
+  public:
+    explicit Buffer(GraphBuilder &builder);
+    ~Buffer();
+
+    /// \brief Adds edges from \p from toward each path of \p to. The paths
+    /// that are not nodes are added when merging, hashed from their path
+    void add_edges(path_id from, std::vector<path_id> const &to);
+
+    void flush();
+  };
+
+private:
+  struct Node;
+  struct Shard;
+
+  static size_t const SHARD_COUNT = 64;
+
+  boost::scoped_array<Shard> shards_;
+  node_type next_;
+  edges_type edges_; /// handed over by the buffers
+  boost::scoped_ptr<Lock> lock_; /// protects edges_
+
+  GraphBuilder(GraphBuilder const &);
+  GraphBuilder &operator=(GraphBuilder const &);
+
+  node_type node(path_id path, Hash const *hash);
+  void append(edges_type const &edges);
+
+public:
+  GraphBuilder();
+  ~GraphBuilder();
+
+  /// \brief Adds the node of \p path, thread-safe. If it is added several
+  /// times, the smallest hash is kept, whatever the order
+  node_type add_node(path_id path, Hash const &hash);
+
+  /// \brief Number of nodes seen so far, including the targets of edges
+  size_t size() const;
+
+  /// \brief Inserts the collected nodes and edges in \p graph, the paths
+  /// only seen as targets of an edge hashed with \p algorithm. The buffers
+  /// must have been flushed, and nothing else may use the builder meanwhile
+  void merge(Graph &graph, hash_algorithm_type algorithm) const;
+};
+
+#endif
@@ -17,37 +17,115 @@
 #ifndef BINMAP_HASH_H
 #define BINMAP_HASH_H
 
+#include <string>
+#include <iosfwd>
+#include <cstddef>
+#include <boost/array.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/filesystem/path.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/string.hpp>
+
+class FileContent;
+
+/// Digest algorithms, each database uses a single one
+enum hash_algorithm_type {
+  sha1_algorithm,   ///< SHA1, for compatibility with previous databases
+  sha256_algorithm, ///< SHA-256, truncated to Hash::SIZE bytes
+  fast_algorithm    ///< non cryptographic XXH64 followed by the size, only
+                    ///< meant to identify identical files
+};
+
+/// Name of \p algorithm, as accepted by parse_hash_algorithm
+char const *hash_algorithm_name(hash_algorithm_type algorithm);
+/// Sets \p algorithm from its \p name, returns false if it is unknown
+bool parse_hash_algorithm(std::string const &name,
+                          hash_algorithm_type &algorithm);
 
 /// A facility class to digest a file
+///
+/// The SHA1 is held as its 20 raw bytes, the hexadecimal form is only built
+/// for display. A default constructed Hash is null, it displays as an empty
+/// string.
 class Hash {
 
-  std::string digest_;
+public:
+  static const size_t SIZE = 20;
+
+private:
+  boost::array<boost::uint8_t, SIZE> digest_;
+
+  friend class Hasher;
 
 public:
   Hash();
 
-  /// Builds and store the hash of \p filename, using a SHA1.
-  explicit Hash(boost::filesystem::path const &filename);
+  /// Builds and store the hash of \p filename, using \p algorithm.
+  Hash(boost::filesystem::path const &filename, hash_algorithm_type algorithm);
+  /// Parses the hexadecimal form of a hash, as returned by str(), throws
+  /// std::invalid_argument if \p value is not one
   explicit Hash(std::string const &value);
+  /// Copies the raw bytes of a digest, as returned by data(), throws
+  /// std::invalid_argument if \p size is not SIZE
+  Hash(boost::uint8_t const *data, size_t size);
+
+  /// Hexadecimal form, empty for a null hash
+  std::string str() const;
 
-  /// Implicit conversion to string
-  std::string const &str() const;
-  char const *c_str() const;
+  /// Raw bytes of the digest
+  boost::uint8_t const *data() const;
   size_t size() const;
 
-  /// Comparison operators  @{
+  bool null() const;
+
+  /// Comparison operators, on the raw bytes @{
   bool operator<(Hash const &other) const;
   bool operator>(Hash const &other) const;
   bool operator==(Hash const &other) const;
   bool operator!=(Hash const &other) const;
   /// }
-        template < class Archive >
-        void serialize(Archive & ar, unsigned int) {
-                ar & digest_;
-        }
+
+  /// Archives hold the hexadecimal form
+  template <class Archive> void save(Archive &ar, unsigned int) const {
+    std::string const value = str();
+    ar &value;
+  }
+
+  template <class Archive> void load(Archive &ar, unsigned int) {
+    std::string value;
+    ar &value;
+    *this = Hash(value);
+  }
+
+  BOOST_SERIALIZATION_SPLIT_MEMBER()
 };
 
+/// For boost unordered containers, the digest is already evenly distributed
+std::size_t hash_value(Hash const &hash);
+
 std::ostream &operator<<(std::ostream &, Hash const &);
 
+/// Incremental computation of a Hash, for data that does not come from a file
+/// opened by Hash itself
+class Hasher {
+  struct Context;
+  Context *context_;
+
+  Hasher(Hasher const &);
+  Hasher &operator=(Hasher const &);
+  void initialize(hash_algorithm_type algorithm);
+
+public:
+  explicit Hasher(hash_algorithm_type algorithm);
+  ~Hasher();
+
+  /// Feeds \p size bytes at \p data
+  void update(char const *data, size_t size);
+  /// Feeds the whole of \p content, read in chunks if it is streamed
+  void update(FileContent const &content);
+
+  /// Hash of all the data fed so far, to be called once
+  Hash digest();
+};
+
 #endif
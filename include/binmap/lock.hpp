@@ -0,0 +1,50 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef BINMAP_LOCK_HPP
+#define BINMAP_LOCK_HPP
+
+#ifdef _OPENMP
+# include <omp.h>
+#endif
+
+/// \brief A mutex, backed by OpenMP when available, a no-op otherwise
+class Lock {
+#ifdef _OPENMP
+  omp_lock_t lock_;
+#endif
+  Lock(Lock const &);
+  Lock &operator=(Lock const &);
+
+public:
+  Lock();
+  ~Lock();
+  void acquire();
+  void release();
+
+  /// \brief Holds \p lock for the lifetime of the guard
+  class Guard {
+    Lock &lock_;
+    Guard(Guard const &);
+    Guard &operator=(Guard const &);
+
+  public:
+    explicit Guard(Lock &lock) : lock_(lock) { lock_.acquire(); }
+    ~Guard() { lock_.release(); }
+  };
+};
+
+#endif
@@ -25,6 +25,7 @@
 #include <boost/unordered_set.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/serialization/string.hpp>
+#include <boost/serialization/split_member.hpp>
 #include "boost_ex/serialization/unordered_set.hpp"
 
 class MetadataInfo {
@@ -110,13 +111,15 @@ std::ostream &operator<<(std::ostream &os, MetadataInfo const &info);
 
 class Metadata {
 
-  boost::unordered_map<std::string, MetadataInfo> db_;
+  boost::unordered_map<Hash, MetadataInfo> db_;
 
   Metadata(Metadata const &);
 
 public:
   typedef Hash key_type;
   typedef MetadataInfo value_type;
+  typedef boost::unordered_map<Hash, MetadataInfo>::const_iterator
+      const_iterator;
 
   Metadata();
 
@@ -124,10 +127,33 @@ public:
 
   value_type operator[](key_type const &key) const;
 
+  const_iterator begin() const { return db_.begin(); }
+  const_iterator end() const { return db_.end(); }
+  size_t size() const { return db_.size(); }
+
+  /// Archives key the metadata by the hexadecimal form of the hash
   template < class Archive >
-  void serialize(Archive & ar, unsigned int) {
-      ar & db_;
+  void save(Archive & ar, unsigned int) const {
+      boost::unordered_map<std::string, MetadataInfo> db;
+      for (boost::unordered_map<Hash, MetadataInfo>::const_iterator
+               iter = db_.begin();
+           iter != db_.end(); ++iter)
+        db.insert(std::make_pair(iter->first.str(), iter->second));
+      ar & db;
   }
+
+  template < class Archive >
+  void load(Archive & ar, unsigned int) {
+      boost::unordered_map<std::string, MetadataInfo> db;
+      ar & db;
+      db_.clear();
+      for (boost::unordered_map<std::string, MetadataInfo>::const_iterator
+               iter = db.begin();
+           iter != db.end(); ++iter)
+        db_.insert(std::make_pair(Hash(iter->first), iter->second));
+  }
+
+  BOOST_SERIALIZATION_SPLIT_MEMBER()
 };
 
 template<class Iterator>
@@ -146,8 +172,4 @@ inline void MetadataInfo::add_imported_symbols(Iterator begin, Iterator end)
 
 }
 
-
-
-
-
 #endif
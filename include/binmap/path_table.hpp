@@ -0,0 +1,107 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef BINMAP_PATH_TABLE_HPP
+#define BINMAP_PATH_TABLE_HPP
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/filesystem/path.hpp>
+
+/// \brief Identifier of a path interned in the PathTable
+typedef boost::uint32_t path_id;
+
+class Lock;
+
+/// \brief The paths known to the process, each one held once
+///
+/// Paths form a trie of their components: a path is its parent directory and
+/// its last component, so the directories shared by many files are stored
+/// once. Identifiers are never reused, the empty path is 0.
+///
+/// Paths are stored in their component form: ``/usr//lib'' is interned as
+/// ``/usr/lib''.
+///
+/// The index is split in shards, each one behind its own lock, so that
+/// threads interning unrelated paths seldom wait for each other. Entries are
+/// never moved once added, and an identifier is only handed out once its
+/// entry is written: path(), parent() and filename() take no lock.
+class PathTable {
+  typedef std::pair<path_id, std::string> entry_key;
+  typedef boost::unordered_map<entry_key, path_id> index_type;
+  typedef index_type::value_type entry_type;
+
+  struct Shard;
+
+  static size_t const SHARD_COUNT = 64;
+  static unsigned const CHUNK_BITS = 16;
+  static size_t const CHUNK_SIZE = size_t(1) << CHUNK_BITS;
+
+  Shard *shards_;
+  // entries by identifier, in chunks of CHUNK_SIZE allocated as needed. The
+  // vector of chunks is sized once, it is never reallocated
+  std::vector<entry_type const **> chunks_;
+  size_t size_;
+  // protects the allocation of identifiers
+  Lock *lock_;
+
+  PathTable();
+  PathTable(PathTable const &);
+  PathTable &operator=(PathTable const &);
+
+  Shard &shard(entry_key const &key) const;
+  path_id add(path_id parent, std::string const &name);
+  bool lookup(path_id parent, std::string const &name, path_id &id) const;
+  entry_type const &entry(path_id id) const;
+
+public:
+  static path_id const root = 0;
+
+  /// \brief The table shared by the process
+  static PathTable &get();
+
+  /// \brief Gets the identifier of \p path, adding it if needed
+  path_id intern(boost::filesystem::path const &path);
+
+  /// \brief Gets the identifier of the entry \p name of the directory
+  /// \p parent, adding it if needed
+  path_id intern(path_id parent, std::string const &name);
+
+  /// \brief Sets \p id to the identifier of \p path, returns false if the
+  /// path has never been interned
+  bool find(boost::filesystem::path const &path, path_id &id) const;
+
+  /// \brief Sets \p id to the identifier of the entry \p name of the
+  /// directory \p parent, returns false if it has never been interned
+  bool child(path_id parent, std::string const &name, path_id &id) const;
+
+  /// \brief Builds the path of \p id
+  boost::filesystem::path path(path_id id) const;
+
+  /// \brief Identifier of the directory that holds \p id
+  path_id parent(path_id id) const;
+
+  /// \brief Last component of \p id
+  std::string filename(path_id id) const;
+
+  /// \brief Number of interned paths, the empty one included
+  size_t size() const;
+};
+
+#endif
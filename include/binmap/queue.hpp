@@ -0,0 +1,142 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef BINMAP_QUEUE_HPP
+#define BINMAP_QUEUE_HPP
+
+#include <deque>
+#include <utility>
+#include <cstddef>
+#include <iosfwd>
+#include <ciso646>
+
+#include "binmap/lock.hpp"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+/// \brief Lets idle threads sleep until another thread notifies a change.
+///
+/// A waiting thread reads generation() first, then checks whether it has
+/// something to do, and waits for that generation to pass if not: a change
+/// notified in between is never missed.
+class Signal {
+  boost::mutex mutex_;
+  boost::condition_variable changed_;
+  unsigned long generation_;
+  unsigned waiting_;
+
+  Signal(Signal const &);
+  Signal &operator=(Signal const &);
+
+public:
+  Signal();
+
+  /// \brief Number of changes notified so far
+  unsigned long generation();
+  /// \brief Wakes up the threads waiting for a change
+  void notify();
+  /// \brief Blocks until a change is notified after \p generation
+  void wait(unsigned long generation);
+};
+
+/// \brief Statistics gathered by a Queue
+struct QueueStats {
+  size_t pushed;      ///< number of elements that went through the queue
+  size_t max_depth;   ///< largest number of elements waiting at once
+  size_t max_bytes;   ///< largest number of bytes held at once
+  size_t depth_sum;   ///< sum of the depths seen by each push
+  size_t full;        ///< number of pushes that found the queue full
+  size_t empty;       ///< number of pops that found the queue empty
+
+  QueueStats();
+  double average_depth() const;
+};
+
+std::ostream &operator<<(std::ostream &os, QueueStats const &stats);
+
+/// \brief A multi-producer, multi-consumer FIFO holding up to \p capacity
+/// elements, 0 meaning unbounded. Each push is notified to \p signal, if any.
+///
+/// Operations never block: a producer facing a full queue is expected to do
+/// something else, typically consume the queue downstream, and retry. A
+/// consumer facing empty queues waits on their Signal.
+template <class T> class Queue {
+  std::deque<std::pair<T, size_t> > elements_; // with their size in bytes
+  size_t capacity_;
+  size_t byte_capacity_;
+  size_t bytes_;
+  QueueStats stats_;
+  mutable Lock lock_;
+  Signal *signal_;
+
+  Queue(Queue const &);
+  Queue &operator=(Queue const &);
+
+public:
+  /// \brief A queue of at most \p capacity elements and \p byte_capacity
+  /// bytes, unbounded if 0. A single element may exceed \p byte_capacity
+  explicit Queue(size_t capacity = 0, Signal *signal = 0,
+                 size_t byte_capacity = 0)
+      : capacity_(capacity), byte_capacity_(byte_capacity), bytes_(0),
+        signal_(signal) {}
+
+  /// \brief Appends \p value, which holds \p bytes bytes, returns false if
+  /// the queue is full
+  bool try_push(T const &value, size_t bytes = 0) {
+    {
+      Lock::Guard guard(lock_);
+      if ((capacity_ and elements_.size() >= capacity_) or
+          (byte_capacity_ and not elements_.empty() and
+           bytes_ + bytes > byte_capacity_)) {
+        ++stats_.full;
+        return false;
+      }
+      elements_.push_back(std::make_pair(value, bytes));
+      bytes_ += bytes;
+      ++stats_.pushed;
+      stats_.depth_sum += elements_.size();
+      if (elements_.size() > stats_.max_depth)
+        stats_.max_depth = elements_.size();
+      if (bytes_ > stats_.max_bytes)
+        stats_.max_bytes = bytes_;
+    }
+    if (signal_)
+      signal_->notify();
+    return true;
+  }
+
+  /// \brief Moves the oldest element to \p value, returns false if the queue
+  /// is empty
+  bool try_pop(T &value) {
+    Lock::Guard guard(lock_);
+    if (elements_.empty()) {
+      ++stats_.empty;
+      return false;
+    }
+    value = elements_.front().first;
+    bytes_ -= elements_.front().second;
+    elements_.pop_front();
+    return true;
+  }
+
+  QueueStats stats() const {
+    Lock::Guard guard(lock_);
+    return stats_;
+  }
+};
+
+#endif
@@ -0,0 +1,52 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef BINMAP_REACHABILITY_HPP
+#define BINMAP_REACHABILITY_HPP
+
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <boost/shared_ptr.hpp>
+
+class Condensation;
+
+/// \brief Transitive closure of a directed graph, answers whether a vertex
+/// can be reached from another one.
+///
+/// Works on the condensation of the graph. Each component is numbered in the
+/// post-order of a spanning forest and labelled with the intervals of the
+/// numbers it reaches: the interval of its own spanning subtree merged with
+/// the ones of its successors. Dependency graphs are mostly trees, so there
+/// are few intervals per component.
+class Reachability {
+  typedef std::pair<unsigned, unsigned> interval_type;
+
+  boost::shared_ptr<Condensation const> condensation_;
+  std::vector<unsigned> order_;           /// post-order number of each component
+  std::vector<size_t> offsets_;           /// first interval of each component
+  std::vector<interval_type> intervals_;  /// sorted, disjoint intervals
+
+public:
+  explicit Reachability(
+      boost::shared_ptr<Condensation const> const &condensation);
+
+  /// \brief True if there is a path from \p from to \p to, or if they are the
+  /// same vertex
+  bool reaches(size_t from, size_t to) const;
+};
+
+#endif
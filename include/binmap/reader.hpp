@@ -0,0 +1,65 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef BINMAP_READER_HPP
+#define BINMAP_READER_HPP
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/path.hpp>
+
+/// \brief Receives the content of the files read by a BatchReader
+struct ReadConsumer {
+  virtual ~ReadConsumer();
+
+  /// \brief Next \p size bytes of the \p index -th file. Returns false to
+  /// stop reading it, it is done with then
+  virtual bool data(size_t index, char const *bytes, size_t size) = 0;
+
+  /// \brief Called once the \p index -th file has been read entirely, or
+  /// with \p ok unset if it could not be opened or read
+  virtual void done(size_t index, bool ok) = 0;
+
+  /// \brief Device and inode of the \p index -th file, called once it has
+  /// been opened if the reader can tell them. Does nothing by default
+  virtual void identity(size_t index, boost::uint64_t device,
+                        boost::uint64_t inode);
+};
+
+/// \brief Reads many files at once
+class BatchReader {
+public:
+  virtual ~BatchReader();
+
+  /// \brief Reads all \p paths, or only their first \p limit bytes if not
+  /// 0. The files may be read concurrently, but the chunks of a given file
+  /// are delivered in order, and all calls happen on the calling thread.
+  virtual void read(std::vector<boost::filesystem::path> const &paths,
+                    ReadConsumer &consumer, size_t limit = 0) = 0;
+
+  /// \brief False once the reader failed in a way it cannot recover from.
+  /// The files of the batch not read then are reported as failed, and the
+  /// reader should be dropped
+  virtual bool ready() const = 0;
+
+  /// \brief Returns an io_uring based reader if it has been enabled at build
+  /// time and the kernel supports it, a null pointer otherwise
+  static std::auto_ptr<BatchReader> create();
+};
+
+#endif
@@ -19,9 +19,34 @@
 
 #include <boost/filesystem/path.hpp>
 #include <vector>
+#include <string>
+
+/// \brief Number of threads dedicated to each stage of the scan: walk,
+/// classify, hash and parse
+struct StageJobs {
+  int walk, classify, hash, parse;
+
+  /// \brief Default split of \p jobs threads among the stages
+  explicit StageJobs(int jobs = 1);
+  StageJobs(int walk, int classify, int hash, int parse);
+
+  int operator[](int stage) const;
+  /// \brief Size of the thread team, at least 1
+  int total() const;
+  /// \brief Stage of the \p thread -th thread of the team
+  int stage_of(int thread) const;
+};
+
+/// \brief \p hash_algorithm names the algorithm used to hash the files of a
+/// new database. Existing databases keep theirs, an empty name selects it, or
+/// sha1 for a new one. \p compress deflates what is written to the database.
 int scan(std::vector<boost::filesystem::path> const &,
          boost::filesystem::path const &,
          boost::filesystem::path const &,
-         std::vector<boost::filesystem::path>);
+         std::vector<boost::filesystem::path>,
+         StageJobs const &jobs = StageJobs(), bool incremental = false,
+         bool stats = false,
+         std::string const &hash_algorithm = std::string(),
+         bool compress = false);
 
 #endif
@@ -0,0 +1,92 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef BINMAP_STAT_CACHE_HPP
+#define BINMAP_STAT_CACHE_HPP
+
+#include "binmap/hash.hpp"
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/filesystem/path.hpp>
+
+#ifndef _WIN32
+struct stat;
+#endif
+
+/// \brief Identity of a regular file, as reported by the filesystem
+/// Two equal FileStat are assumed to describe the same, unchanged, content.
+struct FileStat {
+  boost::uint64_t device;
+  boost::uint64_t inode;
+  boost::uint64_t size;
+  boost::uint64_t mtime_ns;
+  boost::uint64_t ctime_ns;
+
+  FileStat();
+
+  /// Fills the structure from \p path, without following symlinks.
+  /// Returns false if \p path cannot be stat'ed or is not a regular file.
+  bool read(boost::filesystem::path const &path);
+#ifndef _WIN32
+  /// Fills the structure from an already retrieved \p st.
+  bool read(struct stat const &st);
+#endif
+
+  bool operator==(FileStat const &other) const;
+  bool operator!=(FileStat const &other) const;
+};
+
+/// \brief Results of the analysis of each file from the previous scan
+/// Files whose FileStat did not change since then are not analysed again.
+class StatCache {
+
+public:
+  struct Record {
+    FileStat stat;
+    bool handled; /// false if no collector handled the file
+    Hash hash;
+    std::vector<boost::filesystem::path> deps;
+    bool has_metadata;
+    std::string error;
+
+    Record();
+  };
+
+private:
+  boost::unordered_map<boost::filesystem::path, Record> records_;
+
+public:
+  typedef boost::unordered_map<boost::filesystem::path, Record>::const_iterator
+      const_iterator;
+
+  /// Retrieves the record of \p path, if its stat still matches \p stat.
+  Record const *find(boost::filesystem::path const &path,
+                     FileStat const &stat) const;
+
+  void insert(boost::filesystem::path const &path, Record const &record);
+
+  void swap(StatCache &other);
+
+  size_t size() const;
+
+  const_iterator begin() const { return records_.begin(); }
+  const_iterator end() const { return records_.end(); }
+};
+
+#endif
@@ -18,6 +18,7 @@
 #define BINMAP_VIEW_HPP
 
 #include <boost/filesystem/path.hpp>
-int view(boost::filesystem::path const &, boost::filesystem::path const &);
+int view(boost::filesystem::path const &, boost::filesystem::path const &,
+         bool counts = false);
 
 #endif
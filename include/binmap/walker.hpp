@@ -0,0 +1,54 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#ifndef BINMAP_WALKER_HPP
+#define BINMAP_WALKER_HPP
+
+#include "binmap/stat_cache.hpp"
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+
+/// \brief A directory entry, along with what was learnt while listing it
+struct DirectoryItem {
+  boost::filesystem::path path;
+  /// type of the entry itself, symlinks are not followed.
+  /// status_unknown if it has not been determined yet.
+  boost::filesystem::file_status status;
+  /// identity of the entry, set when the entry itself was stat'ed or opened,
+  /// both are 0 when unknown
+  boost::uint64_t device, inode;
+  /// only filled for regular files, and only on request
+  FileStat stat;
+  bool has_stat;
+
+  DirectoryItem(boost::filesystem::path const &path = boost::filesystem::path(),
+                boost::filesystem::file_status const &status =
+                    boost::filesystem::file_status(
+                        boost::filesystem::status_unknown));
+};
+
+/// \brief Appends the entries of \p directory to \p items
+/// The type of each entry is taken from the directory listing when the
+/// filesystem provides it, so that most entries do not require any stat.
+/// If \p with_stat is set, a FileStat is also collected for regular files.
+/// Returns false if \p directory cannot be listed.
+bool list_directory(std::vector<DirectoryItem> &items,
+                    boost::filesystem::path const &directory, bool with_stat);
+
+#endif
@@ -20,12 +20,15 @@
  */
 #include "binmap_config.hpp"
 #include "binmap/log.hpp"
+#include "binmap/hash.hpp"
 #include "binmap/scan.hpp"
 #include "binmap/view.hpp"
 
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <cstdio>
+#include <ciso646>
 
 #include <boost/program_options.hpp>
 #include <boost/foreach.hpp>
@@ -200,7 +203,27 @@ class ScanCommand : public SubCommand {
       }
       // otherwise, keep inputs[0] as it is the sole entry point
     }
-    return scan(inputs, output, root, blacklist);
+    StageJobs jobs(vm_["jobs"].as<int>());
+    if (vm_.count("stage-jobs") != 0) {
+      std::string const &spec = vm_["stage-jobs"].as<std::string>();
+      char trailing;
+      if (std::sscanf(spec.c_str(), "%d,%d,%d,%d%c", &jobs.walk,
+                      &jobs.classify, &jobs.hash, &jobs.parse,
+                      &trailing) != 4 or
+          jobs.walk < 0 or jobs.classify < 0 or jobs.hash < 0 or
+          jobs.parse < 0)
+        throw po::invalid_option_value(spec);
+    }
+    std::string hash;
+    if (vm_.count("hash") != 0) {
+      hash = vm_["hash"].as<std::string>();
+      hash_algorithm_type algorithm;
+      if (not parse_hash_algorithm(hash, algorithm))
+        throw po::invalid_option_value(hash);
+    }
+    return scan(inputs, output, root, blacklist, jobs,
+                vm_.count("incremental") != 0, vm_.count("stats") != 0, hash,
+                vm_.count("compress") != 0);
   }
 
 public:
@@ -211,6 +234,12 @@ public:
       ("output,o", po::value<boost::filesystem::path>(), "output path [default=" DEFAULT_BLOBS "]")
       ("chroot", "target is the image of another system")
       ("exclude", po::value<std::vector<boost::filesystem::path> >(), "exclude given paths from the scan")
+      ("jobs,j", po::value<int>()->default_value(1), "number of threads used to analyse files")
+      ("stage-jobs", po::value<std::string>(), "threads of the walk, classify, hash and parse stages, as in 1,1,2,4 [overrides --jobs]")
+      ("stats", "log the statistics of each stage on completion, at the info level")
+      ("incremental", "only analyse files that changed since the previous incremental scan")
+      ("hash", po::value<std::string>(), "hash algorithm of a new database: sha1, sha256 or fast [default=sha1]")
+      ("compress", "compress what the scan writes to the database with zlib")
       ("verbose,v", po::value<int>()->default_value(logging::error), "verbosity level");
 
     std::ifstream config_file(".binmap.cfg");
@@ -236,7 +265,8 @@ class ViewCommand : public SubCommand {
         vm_.count("input") != 0 ? vm_["input"].as<boost::filesystem::path>()
                                 : boost::filesystem::path(DEFAULT_BLOBS),
         vm_.count("output") != 0 ? vm_["output"].as<boost::filesystem::path>()
-                                 : boost::filesystem::path(DEFAULT_DOT));
+                                 : boost::filesystem::path(DEFAULT_DOT),
+        vm_.count("counts") != 0);
   }
 
 public:
@@ -245,6 +275,9 @@ public:
                         "input path [default=" DEFAULT_BLOBS "]");
     desc_.add_options()("output,o", po::value<boost::filesystem::path>(),
                         "output path [default=" DEFAULT_DOT "]");
+    desc_.add_options()("counts", "label each node with the number of nodes "
+                                  "that transitively depend on it and the "
+                                  "number of nodes it transitively depends on");
   }
 };
 
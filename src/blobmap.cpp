@@ -19,12 +19,21 @@
  * Implementation of blobmap.hpp interface
  */
 #include "binmap/blobmap.hpp"
+#include "binmap/condensation.hpp"
+#include "binmap/database.hpp"
+#include "binmap/file_content.hpp"
+#include "binmap/lock.hpp"
 #include "binmap/log.hpp"
 
 #include <boost/foreach.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <boost/make_shared.hpp>
 #include <boost/archive/text_iarchive.hpp>
+#include <boost/graph/reverse_graph.hpp>
 
 #include <algorithm>
+#include <deque>
+#include <stdexcept>
 #include <iterator>
 #include <ctime>
 #include <ciso646>
@@ -108,6 +117,11 @@ boost::shared_ptr<Metadata const> const &BlobMapView::metadata() const {
   return metadata_;
 }
 
+// set the metadata attribute
+void BlobMapView::metadata(boost::shared_ptr<Metadata const> const &metadata) {
+  metadata_ = metadata;
+}
+
 // read only access to the underlying graph
 Graph const &BlobMapView::graph() const { return graph_; }
 
@@ -181,53 +195,82 @@ void BlobMapView::graph(Graph const &graph) { graph_ = graph; }
 size_t BlobMapView::size() const { return graph_.size(); }
 
 namespace {
-// various functors to check the relationship between two nodes of a graph
-struct is_successor_of {
-  boost::filesystem::path const &self_;
-  is_successor_of(boost::filesystem::path const &self) : self_(self) {}
-
-  bool operator()(boost::filesystem::path const &to, MetadataInfo const &,
-                  BlobMapView const &view) const {
-    return view.has_path(self_, to);
+// marks in ``seen'' all the vertices of ``graph'' reachable from ``start'',
+// with a breadth first search
+template <class G>
+void mark_reachable(G const &graph,
+                    typename boost::graph_traits<G>::vertex_descriptor start,
+                    std::vector<bool> &seen) {
+  std::deque<typename boost::graph_traits<G>::vertex_descriptor> queue;
+  seen[start] = true;
+  queue.push_back(start);
+  while (not queue.empty()) {
+    typename boost::graph_traits<G>::adjacency_iterator iter, end;
+    for (boost::tie(iter, end) = adjacent_vertices(queue.front(), graph);
+         iter != end; ++iter) {
+      if (not seen[*iter]) {
+        seen[*iter] = true;
+        queue.push_back(*iter);
+      }
+    }
+    queue.pop_front();
   }
-};
-struct is_predecessor_of {
-  boost::filesystem::path const &self_;
-  is_predecessor_of(boost::filesystem::path const &self) : self_(self) {}
+}
+}
 
-  bool operator()(boost::filesystem::path const &from, MetadataInfo const &,
-                  BlobMapView const &view) const {
-    return view.has_path(from, self_);
+// copy the ``selected'' nodes and the edges between them to ``out''
+void BlobMapView::induced(std::vector<bool> const &selected,
+                          BlobMapView &out) const {
+  Graph &ograph = out.graph_;
+  for (Graph::vertex_iterator iter = graph_.begin(), end = graph_.end();
+       iter != end; ++iter) {
+    if (selected[*iter])
+      ograph.add_node(graph_.key(*iter), graph_.hash(*iter));
   }
-};
-struct is_connected_to {
-  boost::filesystem::path const &self_;
-  is_connected_to(boost::filesystem::path const &self) : self_(self) {}
-
-  bool operator()(boost::filesystem::path const &node, MetadataInfo const &,
-                  BlobMapView const &view) const {
-    return view.has_path(node, self_) || view.has_path(self_, node);
+  for (Graph::vertex_iterator iter = graph_.begin(), end = graph_.end();
+       iter != end; ++iter) {
+    if (not selected[*iter])
+      continue;
+    std::vector<boost::filesystem::path> vkeys;
+    for (Graph::edge_iterator viter = graph_.edge_begin(*iter),
+                              vend = graph_.edge_end(*iter);
+         viter != vend; ++viter) {
+      Graph::vertex_descriptor v = boost::target(*viter, graph_.graph());
+      if (selected[v])
+        vkeys.push_back(graph_.key(v));
+    }
+    ograph.add_edges(graph_.key(*iter), vkeys);
   }
-};
 }
 
 // compute the graph of all nodes that have a path from or to ``key''
 void BlobMapView::induced_graph(BlobMapView &succ,
                                 boost::filesystem::path const &key) const {
-  return filter(is_connected_to(key), succ);
+  Graph::vertex_descriptor const start = graph_.vertex(key);
+  std::vector<bool> selected(graph_.size(), false), preds(graph_.size(), false);
+  mark_reachable(graph_.graph(), start, selected);
+  mark_reachable(boost::make_reverse_graph(graph_.graph()), start, preds);
+  for (size_t i = 0; i < selected.size(); ++i)
+    selected[i] = selected[i] or preds[i];
+  induced(selected, succ);
 }
 
 // compute the graph of all nodes that have a path from ``key''
 void BlobMapView::induced_successors(BlobMapView &succ,
                                      boost::filesystem::path const &key) const {
-  return filter(is_successor_of(key), succ);
+  std::vector<bool> selected(graph_.size(), false);
+  mark_reachable(graph_.graph(), graph_.vertex(key), selected);
+  induced(selected, succ);
 }
 
 // compute the graph of all nodes that have a path to ``key''
 void
 BlobMapView::induced_predecessors(BlobMapView &succ,
                                   boost::filesystem::path const &key) const {
-  return filter(is_predecessor_of(key), succ);
+  std::vector<bool> selected(graph_.size(), false);
+  mark_reachable(boost::make_reverse_graph(graph_.graph()), graph_.vertex(key),
+                 selected);
+  induced(selected, succ);
 }
 
 // iterator over the values
@@ -263,7 +306,7 @@ operator[](boost::filesystem::path const &filename) const {
 }
 
 // check whether there is a path from ``from'' to ``to''
-// first call is O(n^2) then O(1)
+// the first call builds a reachability index of the graph
 bool BlobMapView::has_path(boost::filesystem::path const &from,
                            boost::filesystem::path const &to) const {
   return graph_.has_path(from, to);
@@ -281,6 +324,49 @@ void BlobMapView::predecessors(Graph::successors_type &preds,
   return graph_.predecessors(preds, key);
 }
 
+// collect the paths of the vertices in ``range''
+static void collect(Graph const &graph, Condensation::range_type const &range,
+                    Graph::successors_type &paths) {
+  for (Condensation::iterator iter = range.first; iter != range.second; ++iter)
+    paths.insert(graph.key(*iter));
+}
+
+// get the components with a cycle, sinks of the condensation first
+void BlobMapView::sccs(std::vector<Graph::successors_type> &components) const {
+  Condensation const &condensation = graph_.condensation();
+  for (size_t c = condensation.size(); c-- > 0;) {
+    Condensation::range_type const members = condensation.members(c);
+    if (members.second - members.first > 1) {
+      components.push_back(Graph::successors_type());
+      collect(graph_, members, components.back());
+    }
+  }
+}
+
+// get the nodes of each layer of the condensation
+void BlobMapView::layers(std::vector<Graph::successors_type> &layers) const {
+  Condensation const &condensation = graph_.condensation();
+  layers.resize(condensation.layer_count());
+  for (size_t l = 0; l < layers.size(); ++l) {
+    Condensation::range_type const components = condensation.layer_members(l);
+    for (Condensation::iterator iter = components.first;
+         iter != components.second; ++iter)
+      collect(graph_, condensation.members(*iter), layers[l]);
+  }
+}
+
+// get the transitive counts of every node, in a single pass
+void BlobMapView::transitive_counts(
+    boost::unordered_map<boost::filesystem::path, std::pair<size_t, size_t> > &
+        counts) const {
+  std::vector<size_t> predecessors, successors;
+  graph_.transitive_counts(predecessors, successors);
+  for (Graph::vertex_iterator iter = graph_.begin(), end = graph_.end();
+       iter != end; ++iter)
+    counts[graph_.key(*iter)] =
+        std::make_pair(predecessors[*iter], successors[*iter]);
+}
+
 // computes the difference between two views, as a ``BlobMapDiff''
 void BlobMapView::diff(BlobMapDiff &diff, BlobMapView const &other) const {
 
@@ -318,13 +404,60 @@ void BlobMapView::diff(BlobMapDiff &diff, BlobMapView const &other) const {
  * Blobmap Implementation
  */
 
+namespace {
+// adds the entries of ``from'' to ``to''
+void merge(Metadata &to, Metadata const &from) {
+  for (Metadata::const_iterator iter = from.begin(), end = from.end();
+       iter != end; ++iter)
+    to.insert(iter->second);
+}
+
+// a copy of ``metadata'' to complete in place of it, so that the views that
+// hold it never see it change
+boost::shared_ptr<Metadata> copy(Metadata const &metadata) {
+  boost::shared_ptr<Metadata> result(new Metadata());
+  merge(*result, metadata);
+  return result;
+}
+}
+
 // get the metadata
 boost::shared_ptr<Metadata const> BlobMap::metadata() const {
+  Lock::Guard guard(*lock_);
   return metadata_;
 }
 
 // set the metadata
-boost::shared_ptr<Metadata> BlobMap::metadata() { return metadata_; }
+boost::shared_ptr<Metadata> BlobMap::metadata() {
+  Lock::Guard guard(*lock_);
+  return metadata_;
+}
+
+// get the stat cache
+StatCache const &BlobMap::stat_cache() const {
+  fetch_stat_cache_();
+  return stat_cache_;
+}
+StatCache &BlobMap::stat_cache() {
+  fetch_stat_cache_();
+  stat_cache_changed_ = true;
+  return stat_cache_;
+}
+
+// read the stat cache ahead of its first use
+void BlobMap::load_stat_cache() const { fetch_stat_cache_(); }
+
+// get or set the algorithm of the hashes
+hash_algorithm_type BlobMap::hash_algorithm() const { return hash_algorithm_; }
+void BlobMap::hash_algorithm(hash_algorithm_type algorithm) {
+  if (algorithm != hash_algorithm_)
+    rewrite_ = true;
+  hash_algorithm_ = algorithm;
+}
+
+// get or set the compression of the sections stored
+database::codec_type BlobMap::codec() const { return codec_; }
+void BlobMap::codec(database::codec_type codec) { codec_ = codec; }
 
 // true if there is at least one graph in the blobmap
 bool BlobMap::empty() const { return graphs_.empty(); }
@@ -335,50 +468,99 @@ Graph &BlobMap::create(graph_key_type const &key) {
   return *(graphs_[key] = new Graph());
 }
 
-// create a new blobmap and fill it with the content of the database ``archive_path''
+// create a new blobmap and fill it with the content of the database ``archive_path'',
+// in the native format or in the text archive format of the first versions
 BlobMap::BlobMap(boost::filesystem::path const &archive_path)
-    : metadata_(new Metadata()) {
-    std::ifstream ifs(archive_path.string().c_str(), std::ios::binary);
-    if (ifs) {
-      boost::archive::text_iarchive ia(ifs);
-      ia & *this;
+    : metadata_(new Metadata()), hash_algorithm_(sha1_algorithm),
+      codec_(database::no_codec), path_(archive_path),
+      stat_cache_fetched_(false), stat_cache_changed_(false), rewrite_(false),
+      cache_size_(4), lock_(new Lock()) {
+    boost::shared_ptr<FileContent const> content(
+        new FileContent(archive_path, FileContent::mapped_access));
+    if (not content->good())
+      return;
+    if (database::is_native(content->data(), content->size())) {
+      source_.reset(new database::Reader(content));
+      hash_algorithm_ = source_->hash_algorithm();
+      std::vector<graph_key_type> keys;
+      source_->keys(keys);
+      BOOST_FOREACH(graph_key_type key, keys) {
+        graphs_[key] = 0;
+      }
+      return;
+    }
+    ContentStream stream(*content);
+    boost::archive::text_iarchive ia(stream);
+    ia & *this;
+    // stored graphs are only read, keep their compact form
+    BOOST_FOREACH(graph_map_t::value_type const &kv, graphs_) {
+      kv.second->freeze();
     }
 }
 
+// write the blobmap to the database ``archive_path'', in the native format.
+// If it is the native database the blobmap was read from, the new snapshots,
+// their metadata and the stat cache are appended to it, unless something it
+// holds changed. Otherwise the whole database is written aside first, since
+// snapshots may still be fetched from the one being replaced. The blobmap
+// reads from the database it wrote from then on
+void BlobMap::store(boost::filesystem::path const &archive_path) {
+  boost::system::error_code error;
+  if (source_ and not rewrite_ and
+      boost::filesystem::equivalent(archive_path, path_, error))
+    database::append(archive_path, *source_, *this, stat_cache_changed_);
+  else {
+    if (source_) {
+      Lock::Guard guard(*lock_);
+      boost::shared_ptr<Metadata> const metadata = copy(*metadata_);
+      source_->metadata(*metadata);
+      metadata_ = metadata;
+    }
+    database::replace(archive_path, *this);
+  }
+  if (boost::filesystem::equivalent(archive_path, path_, error)) {
+    source_.reset(new database::Reader(
+        boost::make_shared<FileContent const>(archive_path,
+                                              FileContent::mapped_access)));
+    stat_cache_changed_ = rewrite_ = false;
+  }
+}
+
 // destroys the blobmap and flush its content to the db
 // note that the flush is *not* done before
 BlobMap::~BlobMap() {
+  BOOST_FOREACH(graph_map_t::value_type const &kv, graphs_) {
+    delete kv.second;
+  }
 }
 
+size_t BlobMap::cache_size() const { return cache_size_; }
+void BlobMap::cache_size(size_t size) { cache_size_ = std::max<size_t>(1, size); }
+
 // get the most recent graph in the blobmap
-void BlobMap::back(BlobMapView &bmv) const {
-  return bmv.graph((*this)[back_key()]);
-}
+void BlobMap::back(BlobMapView &bmv) const { return at(bmv, back_key()); }
 
 // builds the view associated to ``key''
 void BlobMap::at(BlobMapView &bmv, graph_key_type const &key) const {
-  return bmv.graph((*this)[key]);
+  snapshot_type const snapshot = snapshot_(key);
+  bmv.graph(*snapshot.first);
+  bmv.metadata(snapshot.second);
 }
 
 // iterate over keys
 MapKeyIterator<BlobMap::graph_map_t> BlobMap::kbegin() const {
-  return graphs_.begin();
+  return MapKeyIterator<graph_map_t>(graphs_.begin());
 }
 MapKeyIterator<BlobMap::graph_map_t> BlobMap::kend() const {
-  return graphs_.end();
+  return MapKeyIterator<graph_map_t>(graphs_.end());
 }
 
 // iterate over values
 MapValueIterator<BlobMap::graph_map_t> BlobMap::vbegin() const {
-  // fetch all graphs to prepare for the iteration process
-  // this is costly...
-  BOOST_FOREACH(graph_map_t::value_type const& kv, graphs_) {
-    fetch_(kv.first);
-  }
-  return MapValueIterator<BlobMap::graph_map_t>(metadata_, graphs_.begin());
+  return MapValueIterator<BlobMap::graph_map_t>(this, graphs_.begin());
 }
 MapValueIterator<BlobMap::graph_map_t> BlobMap::vend() const {
-  return MapValueIterator<BlobMap::graph_map_t>(metadata_, graphs_.end());
+  return MapValueIterator<BlobMap::graph_map_t>(this, graphs_.end());
 }
 
 // iterate over items
@@ -396,15 +578,44 @@ BlobMap::end() const {
 // find if ``key'' is in the blobmap
 MapKeyIterator<BlobMap::graph_map_t>
 BlobMap::find(graph_key_type const &key) const {
-  return graphs_.find(key);
+  return MapKeyIterator<graph_map_t>(graphs_.find(key));
 }
 
 // number of graphs stored in the blobmap
 size_t BlobMap::size() const { return graphs_.size(); }
 
-// fetches the graph associated to ``key'' into the cache and build it
-// there can be only one graph in the cache
-void BlobMap::fetch_(graph_key_type const &key) const {
+// the lock must be held. Fetches the graph associated to ``key'' from the
+// database, with the metadata of its files, unless it is among the
+// ``cache_size_'' most recently used ones. A snapshot dropped from that LRU
+// cache lives on as long as someone holds it
+BlobMap::snapshot_type BlobMap::fetch_(graph_key_type const &key) const {
+  for (cache_type::iterator cached = fetched_.begin(), end = fetched_.end();
+       cached != end; ++cached) {
+    if (cached->first == key) {
+      fetched_.splice(fetched_.begin(), fetched_, cached);
+      return cached->second;
+    }
+  }
+  boost::shared_ptr<Graph> graph(new Graph());
+  boost::shared_ptr<Metadata> metadata(new Metadata());
+  source_->graph(key, *graph, *metadata);
+  fetched_.push_front(std::make_pair(key, snapshot_type(graph, metadata)));
+  while (fetched_.size() > cache_size_)
+    fetched_.pop_back();
+  return fetched_.front().second;
+}
+
+// reads the stat cache from the database on first use
+void BlobMap::fetch_stat_cache_() const {
+  if (not source_)
+    return;
+  Lock::Guard guard(*lock_);
+  if (stat_cache_fetched_)
+    return;
+  stat_cache_fetched_ = true;
+  boost::shared_ptr<Metadata> const metadata = copy(*metadata_);
+  source_->stat_cache(stat_cache_, *metadata);
+  metadata_ = metadata;
 }
 
 namespace {
@@ -425,18 +636,50 @@ BlobMap::graph_key_type const &BlobMap::back_key() const {
   return imax->first;
 }
 
-// get the Graph associated to ``key''
-Graph const &BlobMap::operator[](graph_key_type const &key) const {
-  fetch_(key);
+namespace {
+// the graphs held by the blobmap itself live as long as it does
+struct NullDeleter {
+  void operator()(Graph const *) const {}
+};
+}
+
+// get the Graph associated to ``key'' and the metadata of its files
+BlobMap::snapshot_type BlobMap::snapshot_(graph_key_type const &key) const {
+  Lock::Guard guard(*lock_);
   graph_map_t::const_iterator where = graphs_.find(key);
   if(where == graphs_.end()) {
     throw std::runtime_error("no graph associated to this key");
   }
-  return *where->second;
+  if (where->second)
+    return snapshot_type(
+        boost::shared_ptr<Graph const>(where->second, NullDeleter()),
+        metadata_);
+  return fetch_(key);
+}
+
+// get the Graph associated to ``key''
+boost::shared_ptr<Graph const>
+BlobMap::operator[](graph_key_type const &key) const {
+  return snapshot_(key).first;
 }
 
+// the graph may be modified, it is copied out of the cache and never dropped
 Graph &BlobMap::operator[](graph_key_type const &key) {
-  fetch_(key);
+  Lock::Guard guard(*lock_);
   graph_map_t::iterator where = graphs_.find(key);
+  if(where == graphs_.end()) {
+    throw std::runtime_error("no graph associated to this key");
+  }
+  if (not where->second) {
+    snapshot_type const snapshot = fetch_(key);
+    where->second = new Graph(*snapshot.first);
+    // fetch_ left it first in the cache
+    fetched_.pop_front();
+    boost::shared_ptr<Metadata> const metadata = copy(*metadata_);
+    merge(*metadata, *snapshot.second);
+    metadata_ = metadata;
+  }
+  if (source_ and source_->has(key))
+    rewrite_ = true;
   return *where->second;
 }
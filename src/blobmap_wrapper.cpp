@@ -190,6 +190,37 @@ object python_predecessors(BlobMapView const &self, std::string const &name) {
   return object(preds);
 }
 
+list python_sccs(BlobMapView const &self) {
+  std::vector<Graph::successors_type> components;
+  self.sccs(components);
+  list out;
+  for (size_t i = 0; i < components.size(); ++i)
+    out.append(components[i]);
+  return out;
+}
+list python_layers(BlobMapView const &self) {
+  std::vector<Graph::successors_type> layers;
+  self.layers(layers);
+  list out;
+  for (size_t i = 0; i < layers.size(); ++i)
+    out.append(layers[i]);
+  return out;
+}
+
+dict python_transitive_counts(BlobMapView const &self) {
+  boost::unordered_map<boost::filesystem::path, std::pair<size_t, size_t> >
+      counts;
+  self.transitive_counts(counts);
+  dict out;
+  for (boost::unordered_map<boost::filesystem::path,
+                            std::pair<size_t, size_t> >::const_iterator
+           iter = counts.begin(),
+           end = counts.end();
+       iter != end; ++iter)
+    out[iter->first] = make_tuple(iter->second.first, iter->second.second);
+  return out;
+}
+
 BlobMapView *python_blobmap_item(BlobMap const &self,
                                  BlobMap::graph_key_type key) {
   BlobMapView *bmv = new BlobMapView(self.metadata());
@@ -245,7 +276,7 @@ BOOST_PYTHON_MODULE(blobmap) {
       "--help``),\n"
       "then to load it using the BlobMap class\n";
 
-  class_<BlobMap>(
+  class_<BlobMap, boost::noncopyable>(
       "BlobMap",
       "Abstraction of software dependency graphs\n"
       "\n"
@@ -317,6 +348,17 @@ BOOST_PYTHON_MODULE(blobmap) {
       .def("predecessors", &python_predecessors,
            "blobmapview.predecessors(path) -> set\nSet of absolute file paths "
            "depending on the given node")
+      .def("sccs", &python_sccs,
+           "blobmapview.sccs() -> list\nSets of absolute file paths that "
+           "depend on each other, dependencies first")
+      .def("layers", &python_layers,
+           "blobmapview.layers() -> list\nSets of absolute file paths by "
+           "layer: the first one holds the files without dependencies, the "
+           "others the files whose dependencies all are in the layers below")
+      .def("transitive_counts", &python_transitive_counts,
+           "blobmapview.transitive_counts() -> dict\nMaps each absolute file "
+           "path to the number of files that transitively depend on it and "
+           "the number of files it transitively depends on")
       .def("induced_successors", &python_induced_successors,
            return_value_policy<manage_new_object>(),
            "blobmapview.induced_successors(path) -> BlobmapView\n"
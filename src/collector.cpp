@@ -21,27 +21,123 @@
 #include "binmap/collector.hpp"
 
 #include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
 #include <boost/foreach.hpp>
-#include <set>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cassert>
+#include <ciso646>
 
-// returns a set for all collectors
-std::set<std::auto_ptr<Collector>(*)()>& get_all_collectors(){
-    static std::set<std::auto_ptr<Collector>(*)()>* all_coll_ = new std::set<std::auto_ptr<Collector>(*)()>();
+namespace {
+// a registered collector, along with its signature if any
+struct Registration {
+  std::auto_ptr<Collector>(*collector)();
+  Collector::Signature signature;
+  bool has_signature;
+
+  Registration(std::auto_ptr<Collector>(*collector)(),
+               Collector::Signature const &signature, bool has_signature)
+      : collector(collector), signature(signature),
+        has_signature(has_signature) {}
+};
+}
+
+// returns a vector for all collectors
+static std::vector<Registration>& get_all_collectors(){
+    static std::vector<Registration>* all_coll_ = new std::vector<Registration>();
     return *all_coll_;
 }
 
+
 Collector::~Collector() {}
 
+bool Collector::relocatable() const { return false; }
+
+// reads the first bytes of ``key'', regular files only
+std::string
+Collector::read_header(boost::filesystem::path const &key,
+                       boost::filesystem::file_status const &status) {
+  if (status.type() != boost::filesystem::regular_file)
+    return std::string();
+  char buffer[HEADER_SIZE];
+  std::ifstream stream(key.string().c_str(), std::ios_base::binary);
+  stream.read(buffer, sizeof buffer);
+  return std::string(buffer, stream.gcount());
+}
+
+// true if a registered collector may handle a file of type ``status'' starting
+// with ``header''
+bool Collector::may_handle(boost::filesystem::file_status const &status,
+                           std::string const &header) {
+  BOOST_FOREACH(Registration const &registration, get_all_collectors()) {
+      if (not registration.has_signature or
+          registration.signature.matches(status, header))
+        return true;
+  }
+  return false;
+}
+
 // returns a pointer to the first registered collector capable of handling ``key''
 std::auto_ptr<Collector> Collector::get_collector(boost::filesystem::path const &key) {
-  BOOST_FOREACH(std::auto_ptr<Collector>(*collector)(), get_all_collectors()) {
-      std::auto_ptr<Collector> thecollector = (*collector)();
-      if(thecollector->initialize(key))
+  boost::system::error_code ec;
+  return get_collector(key, boost::filesystem::symlink_status(key, ec));
+}
+
+// same as above, ``status'' being the status of ``key'', symlinks not followed
+std::auto_ptr<Collector>
+Collector::get_collector(boost::filesystem::path const &key,
+                         boost::filesystem::file_status const &status) {
+  boost::shared_ptr<FileContent const> content;
+  if (status.type() == boost::filesystem::regular_file) {
+    content.reset(new FileContent(key));
+    if (not content->good())
+      content.reset();
+  }
+  return get_collector(key, status, content);
+}
+
+// same as above, ``content'' being the content of ``key''. The signatures are
+// checked against its first bytes
+std::auto_ptr<Collector>
+Collector::get_collector(boost::filesystem::path const &key,
+                         boost::filesystem::file_status const &status,
+                         boost::shared_ptr<FileContent const> const &content) {
+  std::string header;
+  if (content)
+    header.assign(content->data(),
+                  std::min(content->size(), size_t(HEADER_SIZE)));
+  BOOST_FOREACH(Registration const &registration, get_all_collectors()) {
+      if (registration.has_signature and
+          not registration.signature.matches(status, header))
+        continue;
+      std::auto_ptr<Collector> thecollector = (*registration.collector)();
+      if(thecollector->initialize(key, status, content))
         return thecollector;
   }
   return std::auto_ptr<Collector>(0);
 }
 
+Collector::Signature::Signature(boost::filesystem::file_type type,
+                                std::string const &magic, size_t offset)
+    : type(type), magic(magic), offset(offset) {
+  assert(offset + magic.size() <= HEADER_SIZE);
+}
+
+bool Collector::Signature::matches(boost::filesystem::file_status const &status,
+                                   std::string const &header) const {
+  return status.type() == type and
+         header.size() >= offset + magic.size() and
+         header.compare(offset, magic.size(), magic) == 0;
+}
+
 Collector::Register::Register(std::auto_ptr<Collector>(*collector)()) {
-    get_all_collectors().insert(collector);
+    get_all_collectors().push_back(
+        Registration(collector, Signature(boost::filesystem::type_unknown),
+                     false));
+}
+
+Collector::Register::Register(std::auto_ptr<Collector>(*collector)(),
+                              Signature const &signature) {
+    get_all_collectors().push_back(Registration(collector, signature, true));
 }
@@ -21,10 +21,11 @@
 class DefaultCollector : public Collector {
 public:
   // the default collector only takes care of files that do not exist
-  bool initialize(boost::filesystem::path const &input_file) {
-    return not boost::filesystem::exists(input_file)
-        // symlinks are not real files, right?
-        and not boost::filesystem::is_symlink(input_file);
+  bool initialize(boost::filesystem::path const &input_file,
+                  boost::filesystem::file_status const &status,
+                  boost::shared_ptr<FileContent const> const &) {
+    // symlinks are not real files, right?
+    return status.type() == boost::filesystem::file_not_found;
   }
 
   // never find any dependency, the file does not exists :-/
@@ -35,4 +36,6 @@ public:
   }
 };
 
-static Collector::Register registry(&make_collector<DefaultCollector>);
+static Collector::Register
+    registry(&make_collector<DefaultCollector>,
+             Collector::Signature(boost::filesystem::file_not_found));
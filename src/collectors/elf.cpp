@@ -49,32 +49,29 @@ class ELFCollector : public Collector {
     FILE* fd_;
     Elf_Binary_t* elf_binary_;
     boost::filesystem::path path_;
+    bool relocatable_; // no dependency was resolved relative to path_
 
 public:
 
-  ELFCollector() : fd_(0), elf_binary_(0) {
+  ELFCollector() : fd_(0), elf_binary_(0), relocatable_(false) {
     if (!initialized) {
       initialized = true;
     }
   }
 
-  bool initialize(boost::filesystem::path const &input_file)
+  bool initialize(boost::filesystem::path const &input_file,
+                  boost::filesystem::file_status const &status,
+                  boost::shared_ptr<FileContent const> const &content)
   {
-    if (not boost::filesystem::exists(input_file))
-      return false;
-
-    if (boost::filesystem::is_symlink(input_file))
+    // neither missing files nor symlinks
+    if (status.type() != boost::filesystem::regular_file or not content)
       return false;
 
+    // the magic bytes have been checked against the content by the
+    // signature, LIEF only takes a path and reads the file on its own
     path_ = input_file;
-    const char* cpath = path_.string().c_str();
-    if (is_elf(cpath)) {
-      this->elf_binary_ = elf_parse(cpath);
-      return true;
-    } else {
-      return false;
-    }
-    return true;
+    this->elf_binary_ = elf_parse(path_.string().c_str());
+    return this->elf_binary_ != 0;
   }
 
   ~ELFCollector() {
@@ -90,7 +87,11 @@ public:
     }
   }
 
+  bool relocatable() const { return relocatable_; }
+
   void operator()(std::set<boost::filesystem::path> &deps) {
+    relocatable_ = true;
+
     /* look for the interpreter
      * there is one for executables and shared libraries
      * but not for static libraries
@@ -129,6 +130,8 @@ public:
       for (size_t j = 0; j < 2; ++j) {
         paths[j].resize(paths_[j].size());
         for (size_t i = 0; i < paths_[j].size(); i++) {
+          if (paths_[j][i].find("$ORIGIN") != std::string::npos)
+            relocatable_ = false;
           boost::replace_all(
             paths_[j][i], "$ORIGIN",
             boost::filesystem::path(path_).parent_path().native());
@@ -195,6 +198,7 @@ public:
         {
           deps.insert(path);
         } else if(boost::filesystem::exists(path_.parent_path() / dep_lib)) {
+          relocatable_ = false;
           deps.insert(path_.parent_path() / dep_lib);
         } else {
           deps.insert(dep_lib);
@@ -374,4 +378,7 @@ private:
 
 bool ELFCollector::initialized = false;
 
-static Collector::Register registry(&make_collector<ELFCollector>);
+static Collector::Register
+    registry(&make_collector<ELFCollector>,
+             Collector::Signature(boost::filesystem::regular_file,
+                                  std::string("\x7f" "ELF", 4)));
@@ -24,10 +24,12 @@
 class SymLinkCollector : public Collector {
   boost::filesystem::path path_;
 public:
-  bool initialize(boost::filesystem::path const &input_file) {
+  bool initialize(boost::filesystem::path const &input_file,
+                  boost::filesystem::file_status const &status,
+                  boost::shared_ptr<FileContent const> const &) {
     path_ = input_file;
     // a symlink is valid only if the link's target exist and is valid
-    if(! boost::filesystem::is_symlink(input_file))
+    if(status.type() != boost::filesystem::symlink_file)
       return false;
     path_ = input_file;
     do {
@@ -42,8 +44,13 @@ public:
     }
     while (boost::filesystem::is_symlink(path_));
 
-    // this assert the symlink is pointing to something we know
-    if(!Collector::get_collector(path_).get())
+    // this assert the symlink is pointing to something we may know. The
+    // target is analysed when it is visited itself, only its type and first
+    // bytes are checked here, as the classify stage does
+    boost::system::error_code ec;
+    boost::filesystem::file_status const target =
+        boost::filesystem::symlink_status(path_, ec);
+    if (not Collector::may_handle(target, Collector::read_header(path_, target)))
       return false;
     // everything is ok
     path_ = input_file;
@@ -72,4 +79,6 @@ public:
   }
 };
 
-static Collector::Register registry(&make_collector<SymLinkCollector>);
+static Collector::Register
+    registry(&make_collector<SymLinkCollector>,
+             Collector::Signature(boost::filesystem::symlink_file));
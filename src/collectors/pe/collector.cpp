@@ -17,17 +17,20 @@
 #include "binmap/log.hpp"
 #include "binmap/collectors/pe/decoder.hpp"
 
-#include <fstream>
 #include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
 
 class PECollector : public Collector {
-  std::ifstream _stream;
+  boost::shared_ptr<FileContent const> _content;
+  boost::scoped_ptr<ContentStream> _stream;
   PEDecoder* _pe;
   boost::filesystem::path _path;
 public:
   PECollector();
   ~PECollector();
-  bool initialize(boost::filesystem::path const &input_file);
+  bool initialize(boost::filesystem::path const &input_file,
+                  boost::filesystem::file_status const &status,
+                  boost::shared_ptr<FileContent const> const &content);
   void operator()(std::set<boost::filesystem::path> &deps);
   void operator()(MetadataInfo &mi);
 };
@@ -35,17 +38,21 @@ public:
 PECollector::PECollector() : _pe(0) {
 }
 
-bool PECollector::initialize(boost::filesystem::path const &path) {
-    if (boost::filesystem::is_symlink(path))
+bool PECollector::initialize(boost::filesystem::path const &path,
+                             boost::filesystem::file_status const &status,
+                             boost::shared_ptr<FileContent const> const &content) {
+    if (status.type() == boost::filesystem::symlink_file || !content)
       return false;
     _path = path;
-    _stream.open(path.string().c_str(), std::ios_base::binary);
+    // the decoder seeks through the content shared with the hash
+    _content = content;
+    _stream.reset(new ContentStream(*_content));
     PeDosHeader dos;
-    if(!_stream.read(reinterpret_cast<char*>(&dos), sizeof(dos)) || !dos.is_valid())
+    if(!_stream->read(reinterpret_cast<char*>(&dos), sizeof(dos)) || !dos.is_valid())
       return false;
 
-    _stream.seekg(0);
-    if(!(_pe = PeDecoderFactory(_stream, true)))
+    _stream->seekg(0);
+    if(!(_pe = PeDecoderFactory(*_stream, true)))
       return false;
     if(! _pe->is_compatible())
         return false;
@@ -82,4 +89,6 @@ void PECollector::operator()(MetadataInfo &mi) {
 }
 
 // static collector
-static Collector::Register registry(&make_collector<PECollector>);
+static Collector::Register
+    registry(&make_collector<PECollector>,
+             Collector::Signature(boost::filesystem::regular_file, "MZ"));
@@ -25,7 +25,7 @@
 * \param file Stream to the PE file to be parsed.
 */
 template <typename _Bits>
-PeData<_Bits>::PeData(std::ifstream& file) : _file(file) {}
+PeData<_Bits>::PeData(std::istream& file) : _file(file) {}
 
 
 /**
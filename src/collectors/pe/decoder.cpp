@@ -63,7 +63,7 @@ PEDecoder* PeDecoderFactory(boost::filesystem::path const &path, bool full_parsi
 * \param full_parsing If set to false, only PE headers will be parsed, otherwise internal tables will also be parsed.
 * \return Pointer to an instance of the class PEDecoder.
 */
-PEDecoder* PeDecoderFactory(std::ifstream& file, bool full_parsing){
+PEDecoder* PeDecoderFactory(std::istream& file, bool full_parsing){
 	uint16_t machine = PEDecoder::machine_type(file);
 
 	PEDecoder* pe;
@@ -89,7 +89,7 @@ PEDecoder* PeDecoderFactory(std::ifstream& file, bool full_parsing){
 * \param file A file stream to the file to be checked.
 * \return The machine type (as from IMAGE_FILE_HEADER::File).
 */
-uint16_t PEDecoder::machine_type(std::ifstream& file){
+uint16_t PEDecoder::machine_type(std::istream& file){
 	PeDosHeader dos;
 	file.read(reinterpret_cast<char*>(&dos), sizeof(dos));
 
@@ -111,7 +111,7 @@ uint16_t PEDecoder::machine_type(std::ifstream& file){
 * \param full_parsing If set to false, only PE headers will be parsed, otherwise internal tables will also be parsed.
 */
 template <typename _Bits>
-pe_decoder<_Bits>::pe_decoder(std::ifstream &file, bool full_parsing)
+pe_decoder<_Bits>::pe_decoder(std::istream &file, bool full_parsing)
 	: _pe_data(file), _file(file), _is_compatible(false)
 {
 	// read IMAGE_DOS_HEADER
@@ -0,0 +1,83 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include "binmap/compact_graph.hpp"
+
+#include <algorithm>
+#include <ciso646>
+
+namespace {
+// orders the vertices of a compact graph by path
+struct IdLess {
+  std::vector<path_id> const &paths_;
+
+  IdLess(std::vector<path_id> const &paths) : paths_(paths) {}
+
+  bool operator()(unsigned lhs, unsigned rhs) const {
+    return paths_[lhs] < paths_[rhs];
+  }
+};
+
+// true if the path of a vertex comes before a path
+struct IdBelow {
+  std::vector<path_id> const &paths_;
+
+  IdBelow(std::vector<path_id> const &paths) : paths_(paths) {}
+
+  bool operator()(unsigned v, path_id id) const { return paths_[v] < id; }
+};
+}
+
+// the edges keep their order among the ones of a same source
+CompactGraph::CompactGraph(
+    std::vector<path_id> &paths, std::vector<Hash> &hashes,
+    std::vector<std::pair<unsigned, unsigned> > const &edges)
+    : graph_(boost::edges_are_unsorted_multi_pass, edges.begin(), edges.end(),
+             paths.size()) {
+  paths_.swap(paths);
+  hashes_.swap(hashes);
+  index();
+}
+
+// builds the path of ``v'' out of the path table
+boost::filesystem::path CompactGraph::key(vertex_descriptor v) const {
+  return PathTable::get().path(paths_[v]);
+}
+
+// a path that has never been interned cannot be in the graph
+bool CompactGraph::find(boost::filesystem::path const &key,
+                        vertex_descriptor &v) const {
+  path_id id;
+  return PathTable::get().find(key, id) and find(id, v);
+}
+
+// binary search of ``key'' among the sorted vertices
+bool CompactGraph::find(path_id key, vertex_descriptor &v) const {
+  std::vector<vertex_descriptor>::const_iterator where = std::lower_bound(
+      sorted_.begin(), sorted_.end(), key, IdBelow(paths_));
+  if (where == sorted_.end() or paths_[*where] != key)
+    return false;
+  v = *where;
+  return true;
+}
+
+// sorts the vertices by path, for find
+void CompactGraph::index() {
+  sorted_.resize(size());
+  for (size_t v = 0; v < sorted_.size(); ++v)
+    sorted_[v] = v;
+  std::sort(sorted_.begin(), sorted_.end(), IdLess(paths_));
+}
@@ -0,0 +1,221 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include "binmap/condensation.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <boost/cstdint.hpp>
+
+Condensation::range_type Condensation::members(unsigned c) const {
+  return range_type(members_.begin() + member_offsets_[c],
+                    members_.begin() + member_offsets_[c + 1]);
+}
+
+Condensation::range_type Condensation::successors(unsigned c) const {
+  return range_type(successors_.begin() + successor_offsets_[c],
+                    successors_.begin() + successor_offsets_[c + 1]);
+}
+
+Condensation::range_type Condensation::layer_members(size_t l) const {
+  return range_type(layered_.begin() + layer_offsets_[l],
+                    layered_.begin() + layer_offsets_[l + 1]);
+}
+
+namespace {
+// the elements of ``groups'' laid out one after the other, ``offsets''
+// telling where each one starts
+void flatten(std::vector<std::vector<unsigned> > const &groups,
+             std::vector<size_t> &offsets, std::vector<unsigned> &values) {
+  offsets.resize(groups.size() + 1);
+  offsets[0] = 0;
+  for (size_t i = 0; i < groups.size(); ++i)
+    offsets[i + 1] = offsets[i] + groups[i].size();
+  values.reserve(offsets.back());
+  for (size_t i = 0; i < groups.size(); ++i)
+    values.insert(values.end(), groups[i].begin(), groups[i].end());
+}
+}
+
+// renumbers the ``count'' components found by strong_components in
+// topological order, ``edges'' being their successors
+void Condensation::build(std::vector<unsigned> const &component, size_t count,
+                         std::vector<std::vector<unsigned> > const &edges) {
+  /* topological order of the components */
+  std::vector<unsigned> in_degree(count, 0), topological;
+  topological.reserve(count);
+  for (size_t c = 0; c < count; ++c)
+    for (size_t i = 0; i < edges[c].size(); ++i)
+      ++in_degree[edges[c][i]];
+  for (size_t c = 0; c < count; ++c)
+    if (in_degree[c] == 0)
+      topological.push_back(c);
+  for (size_t i = 0; i < topological.size(); ++i) {
+    std::vector<unsigned> const &succs = edges[topological[i]];
+    for (size_t j = 0; j < succs.size(); ++j)
+      if (--in_degree[succs[j]] == 0)
+        topological.push_back(succs[j]);
+  }
+  assert(topological.size() == count);
+  std::vector<unsigned> rank(count);
+  for (size_t i = 0; i < count; ++i)
+    rank[topological[i]] = i;
+
+  component_.resize(component.size());
+  std::vector<std::vector<unsigned> > members(count);
+  for (size_t v = 0; v < component.size(); ++v) {
+    component_[v] = rank[component[v]];
+    members[component_[v]].push_back(v);
+  }
+  flatten(members, member_offsets_, members_);
+
+  std::vector<std::vector<unsigned> > successors(count);
+  for (size_t c = 0; c < count; ++c) {
+    std::vector<unsigned> &succs = successors[rank[c]];
+    for (size_t i = 0; i < edges[c].size(); ++i)
+      succs.push_back(rank[edges[c][i]]);
+    std::sort(succs.begin(), succs.end());
+    succs.erase(std::unique(succs.begin(), succs.end()), succs.end());
+  }
+  flatten(successors, successor_offsets_, successors_);
+
+  /* from the sinks up, one layer above the highest successor */
+  layer_.assign(count, 0);
+  size_t layer_count = count == 0 ? 0 : 1;
+  for (size_t c = count; c-- > 0;) {
+    for (size_t i = 0; i < successors[c].size(); ++i)
+      layer_[c] = std::max(layer_[c], layer_[successors[c][i]] + 1);
+    layer_count = std::max<size_t>(layer_count, layer_[c] + 1);
+  }
+  std::vector<std::vector<unsigned> > layers(layer_count);
+  for (size_t c = 0; c < count; ++c)
+    layers[layer_[c]].push_back(c);
+  flatten(layers, layer_offsets_, layered_);
+}
+
+namespace {
+// number of bits set in ``word''
+unsigned popcount(boost::uint64_t word) {
+  word -= (word >> 1) & 0x5555555555555555ULL;
+  word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+  word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  return (word * 0x0101010101010101ULL) >> 56;
+}
+
+// words of the reachability bitsets computed at once. Each thread holds a
+// row of BLOCK_WORDS words for every vertex that reaches the block it works
+// on, and 4 bytes for every vertex before the end of that block: at most
+// 8 * BLOCK_WORDS + 4 bytes per vertex and thread
+size_t const BLOCK_WORDS = 16;
+size_t const BLOCK_BITS = 64 * BLOCK_WORDS;
+
+// no row, for the vertices that do not reach a block
+unsigned const NO_ROW = unsigned(-1);
+
+// sets ``counts'' to the total weight of the vertices reachable from each
+// vertex of a DAG whose edges, sorted, go from ``offsets'' and ``edges'' to
+// greater vertices.
+//
+// The reachability bitsets are computed by blocks of BLOCK_BITS columns,
+// each block in a single backward pass, and only for the vertices that can
+// reach the block: the ones that come before its end and have an edge
+// toward a vertex that reaches it. Blocks are spread among the threads
+void closure_weights(std::vector<size_t> const &offsets,
+                     std::vector<unsigned> const &edges,
+                     std::vector<size_t> const &weights,
+                     std::vector<size_t> &counts) {
+  long const size = weights.size();
+  long const blocks = (size + BLOCK_BITS - 1) / BLOCK_BITS;
+  counts.assign(size, 0);
+
+#pragma omp parallel
+  {
+    std::vector<unsigned> slots; // row of each vertex, NO_ROW if none
+    std::vector<boost::uint64_t> rows;
+
+#pragma omp for schedule(dynamic)
+    for (long block = 0; block < blocks; ++block) {
+      size_t const low = block * BLOCK_BITS,
+                   high = std::min<size_t>(low + BLOCK_BITS, size);
+      bool unit = true;
+      for (size_t v = low; v < high and unit; ++v)
+        unit = weights[v] == 1;
+      slots.assign(high, NO_ROW);
+      rows.clear();
+
+      for (size_t v = high; v-- > 0;) {
+        size_t slot = NO_ROW;
+        if (v >= low) {
+          slot = rows.size() / BLOCK_WORDS;
+          rows.resize(rows.size() + BLOCK_WORDS, 0);
+          rows[slot * BLOCK_WORDS + (v - low) / 64] |= boost::uint64_t(1)
+                                                       << ((v - low) % 64);
+        }
+        for (size_t e = offsets[v]; e < offsets[v + 1] and edges[e] < high;
+             ++e) {
+          size_t const other = slots[edges[e]];
+          if (other == NO_ROW)
+            continue;
+          if (slot == NO_ROW) {
+            slot = rows.size() / BLOCK_WORDS;
+            rows.resize(rows.size() + BLOCK_WORDS, 0);
+          }
+          for (size_t w = 0; w < BLOCK_WORDS; ++w)
+            rows[slot * BLOCK_WORDS + w] |= rows[other * BLOCK_WORDS + w];
+        }
+        if (slot == NO_ROW)
+          continue;
+        slots[v] = slot;
+
+        boost::uint64_t const *row = &rows[slot * BLOCK_WORDS];
+        size_t count = 0;
+        for (size_t w = 0; w < BLOCK_WORDS; ++w) {
+          if (unit)
+            count += popcount(row[w]);
+          else
+            for (boost::uint64_t bits = row[w]; bits; bits &= bits - 1)
+              count += weights[low + 64 * w + popcount((bits & (~bits + 1)) - 1)];
+        }
+#pragma omp atomic
+        counts[v] += count;
+      }
+    }
+  }
+}
+}
+
+// descendants on the DAG itself, ancestors on its transpose, numbered
+// backward so that its edges go to greater vertices as well
+void Condensation::closure_sizes(std::vector<size_t> &descendants,
+                                 std::vector<size_t> &ancestors) const {
+  size_t const count = size();
+  std::vector<size_t> weights(count);
+  for (size_t c = 0; c < count; ++c)
+    weights[c] = member_offsets_[c + 1] - member_offsets_[c];
+  closure_weights(successor_offsets_, successors_, weights, descendants);
+
+  std::vector<std::vector<unsigned> > predecessors(count);
+  for (size_t c = count; c-- > 0;) {
+    for (size_t i = successor_offsets_[c]; i < successor_offsets_[c + 1]; ++i)
+      predecessors[count - 1 - successors_[i]].push_back(count - 1 - c);
+  }
+  std::vector<size_t> offsets;
+  std::vector<unsigned> edges;
+  flatten(predecessors, offsets, edges);
+  std::reverse(weights.begin(), weights.end());
+  closure_weights(offsets, edges, weights, ancestors);
+  std::reverse(ancestors.begin(), ancestors.end());
+}
@@ -0,0 +1,1409 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include "binmap/database.hpp"
+#include "binmap/blobmap.hpp"
+#include "binmap/compact_graph.hpp"
+#include "binmap/file_content.hpp"
+#include "binmap/path_table.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <cstring>
+#include <boost/filesystem/operations.hpp>
+#include <boost/foreach.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <zlib.h>
+#include <ciso646>
+
+#ifndef _WIN32
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+namespace {
+
+typedef database::Reader::Section Section;
+typedef database::Reader::Segment Segment;
+
+char const MAGIC[8] = { 'B', 'I', 'N', 'M', 'A', 'P', 'D', 'B' };
+size_t const TABLE_OFFSET = sizeof(MAGIC) + 4 + 4;
+size_t const HEADER_SIZE = TABLE_OFFSET + 8;
+size_t const ENTRY_SIZE = 4 + 4 + 8 + 8;
+
+boost::uint32_t tag(char const (&name)[5]) {
+  return boost::uint32_t(boost::uint8_t(name[0])) |
+         boost::uint32_t(boost::uint8_t(name[1])) << 8 |
+         boost::uint32_t(boost::uint8_t(name[2])) << 16 |
+         boost::uint32_t(boost::uint8_t(name[3])) << 24;
+}
+
+boost::uint32_t const STRINGS = tag("STRS"), PATHS = tag("PATH"),
+                      HASHES = tag("HASH"), CATALOG = tag("CTLG"),
+                      SNAPSHOT = tag("SNAP"), DELTA = tag("DELT"),
+                      METADATA = tag("META"), STATS = tag("STAT");
+
+// a snapshot is written in full at least every CHECKPOINT_INTERVAL ones,
+// which bounds the number of deltas applied to decode one
+size_t const CHECKPOINT_INTERVAL = 16;
+
+/* encoding of the values of a section */
+class Output {
+  std::string data_;
+
+public:
+  void byte(boost::uint8_t value) { data_.push_back(char(value)); }
+
+  void fixed(boost::uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+      byte(boost::uint8_t(value >> (8 * i)));
+  }
+
+  void varint(boost::uint64_t value) {
+    for (; value >= 0x80; value >>= 7)
+      byte(boost::uint8_t(value | 0x80));
+    byte(boost::uint8_t(value));
+  }
+
+  void bytes(void const *data, size_t size) {
+    data_.append(static_cast<char const *>(data), size);
+  }
+
+  void swap(Output &other) { data_.swap(other.data_); }
+
+  std::string const &data() const { return data_; }
+};
+
+/* entries of a section laid out after the table of their offsets, so that
+ * each one can be decoded alone */
+class Table {
+  std::vector<boost::uint64_t> offsets_;
+  std::string data_;
+
+public:
+  Table() : offsets_(1, 0) {}
+
+  void add(std::string const &entry) {
+    data_ += entry;
+    offsets_.push_back(data_.size());
+  }
+
+  size_t size() const { return offsets_.size() - 1; }
+
+  void write(Output &out) const {
+    out.fixed(size(), 8);
+    for (size_t i = 0; i < offsets_.size(); ++i)
+      out.fixed(offsets_[i], 8);
+    out.bytes(data_.data(), data_.size());
+  }
+};
+
+/* decoding of the values of a section, throws if it is too short */
+class Input {
+  char const *pos_, *end_;
+
+  void need(size_t size) const {
+    if (size_t(end_ - pos_) < size)
+      throw std::runtime_error("truncated database");
+  }
+
+public:
+  Input(char const *data, size_t size) : pos_(data), end_(data + size) {}
+  explicit Input(Section const &section)
+      : pos_(section.data), end_(section.data + section.size) {}
+
+  boost::uint8_t byte() {
+    need(1);
+    return boost::uint8_t(*pos_++);
+  }
+
+  boost::uint64_t fixed(size_t size) {
+    need(size);
+    boost::uint64_t value = 0;
+    for (size_t i = 0; i < size; ++i)
+      value |= boost::uint64_t(boost::uint8_t(*pos_++)) << (8 * i);
+    return value;
+  }
+
+  boost::uint64_t varint() {
+    boost::uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      boost::uint8_t const b = byte();
+      value |= boost::uint64_t(b & 0x7f) << shift;
+      if (not(b & 0x80))
+        return value;
+    }
+    throw std::runtime_error("corrupted database");
+  }
+
+  /* a varint that must be less than ``bound'' */
+  size_t index(size_t bound) {
+    boost::uint64_t const value = varint();
+    if (value >= bound)
+      throw std::runtime_error("corrupted database");
+    return value;
+  }
+
+  char const *bytes(size_t size) {
+    need(size);
+    char const *data = pos_;
+    pos_ += size;
+    return data;
+  }
+};
+
+/* number of entries of a section of ``size'' bytes written as a Table,
+ * ``head'' holding at least its first 8 bytes */
+size_t table_size(Section const &head, size_t size) {
+  boost::uint64_t const count = Input(head).fixed(8);
+  if (count >= (size - 8) / 8)
+    throw std::runtime_error("corrupted database");
+  return count;
+}
+
+/* entry ``index'' of a section written as a Table of ``size'' entries */
+Section table_entry(Section const &section, size_t size, size_t index) {
+  Input offsets(section.data + 8 + 8 * index, 16);
+  boost::uint64_t const begin = offsets.fixed(8), end = offsets.fixed(8);
+  size_t const base = 8 + 8 * (size + 1);
+  if (begin > end or end > section.size - base)
+    throw std::runtime_error("corrupted database");
+  return Section(section.data + base + begin, end - begin);
+}
+
+/* the segment of ``segments'', ordered by first entry, holding ``index'' */
+Segment const &find_segment(std::vector<Segment> const &segments,
+                            size_t index) {
+  size_t low = 0, high = segments.size();
+  while (high - low > 1) {
+    size_t const middle = (low + high) / 2;
+    if (segments[middle].first <= index)
+      low = middle;
+    else
+      high = middle;
+  }
+  if (segments.empty() or index < segments[low].first or
+      index - segments[low].first >= segments[low].size)
+    throw std::runtime_error("corrupted database");
+  return segments[low];
+}
+
+/* an entry of the section table */
+struct Location {
+  boost::uint32_t tag;
+  boost::uint32_t flags;
+  boost::uint64_t offset;
+  boost::uint64_t size;
+
+  Location(boost::uint32_t tag, boost::uint32_t flags, boost::uint64_t offset,
+           boost::uint64_t size)
+      : tag(tag), flags(flags), offset(offset), size(size) {}
+};
+
+/* the codecs sections may be compressed with, by number: compress returns
+ * false if it cannot shrink ``data'', decompress fills exactly ``size''
+ * bytes or throws */
+struct Codec {
+  bool (*compress)(char const *data, size_t size, std::string &compressed);
+  void (*decompress)(char const *data, size_t data_size, char *raw,
+                     size_t size);
+};
+
+bool deflate_compress(char const *data, size_t size, std::string &compressed) {
+  uLongf compressed_size = compressBound(size);
+  compressed.resize(compressed_size);
+  if (compress2(reinterpret_cast<Bytef *>(&compressed[0]), &compressed_size,
+                reinterpret_cast<Bytef const *>(data), size,
+                Z_DEFAULT_COMPRESSION) != Z_OK)
+    return false;
+  compressed.resize(compressed_size);
+  return true;
+}
+
+// inflates in a single pass into the final buffer
+void deflate_decompress(char const *data, size_t data_size, char *raw,
+                        size_t size) {
+  z_stream stream;
+  std::memset(&stream, 0, sizeof(stream));
+  if (inflateInit(&stream) != Z_OK)
+    throw std::runtime_error("cannot initialize zlib");
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+  stream.avail_in = data_size;
+  stream.next_out = reinterpret_cast<Bytef *>(raw);
+  stream.avail_out = size;
+  int const status = inflate(&stream, Z_FINISH);
+  inflateEnd(&stream);
+  if (status != Z_STREAM_END or stream.avail_out != 0)
+    throw std::runtime_error("corrupted database");
+}
+
+Codec const CODECS[] = { { 0, 0 }, { deflate_compress, deflate_decompress } };
+size_t const CODEC_COUNT = sizeof(CODECS) / sizeof(CODECS[0]);
+
+// the flags of a table entry hold the codec of its section in their low byte
+boost::uint32_t const CODEC_MASK = 0xff;
+
+// the first bytes of a section, that hold the counts read when a database is
+// opened, or the time stamp a delta refers to
+size_t head_size(boost::uint32_t tag) {
+  if (tag == STRINGS or tag == PATHS or tag == DELTA)
+    return 8;
+  if (tag == HASHES)
+    return 1;
+  if (tag == METADATA)
+    return 16;
+  return 0;
+}
+
+typedef std::vector<std::pair<boost::uint32_t, Output> > sections_type;
+
+/* the strings, paths and hashes of the sections being written, each one
+ * numbered once, in the order they are first met. The entries already stored
+ * in ``base'', if any, keep their number; new entries are numbered after
+ * them */
+class Dictionary {
+  database::Reader *base_;
+  size_t string_base_, path_base_, hash_base_;
+  boost::unordered_map<std::string, size_t> strings_;
+  boost::unordered_map<path_id, size_t> paths_;
+  boost::unordered_map<Hash, size_t> hashes_;
+  Table string_data_;
+  Output path_data_, hash_data_;
+  size_t new_paths_, new_hashes_;
+
+public:
+  explicit Dictionary(database::Reader *base)
+      : base_(base), string_base_(base ? base->string_count() : 0),
+        path_base_(base ? base->path_count() : 0),
+        hash_base_(base ? base->hash_count() : 0), new_paths_(0),
+        new_hashes_(0) {
+    paths_[PathTable::root] = 0;
+  }
+
+  size_t string(std::string const &value) {
+    boost::unordered_map<std::string, size_t>::const_iterator where =
+        strings_.find(value);
+    if (where != strings_.end())
+      return where->second;
+    size_t index;
+    if (not base_ or not base_->find_string(value, index)) {
+      index = string_base_ + string_data_.size();
+      string_data_.add(value);
+    }
+    strings_[value] = index;
+    return index;
+  }
+
+  // a path comes after its parent
+  size_t path(path_id id) {
+    boost::unordered_map<path_id, size_t>::const_iterator where =
+        paths_.find(id);
+    if (where != paths_.end())
+      return where->second;
+    size_t index;
+    if (not base_ or not base_->find_path(id, index)) {
+      PathTable &table = PathTable::get();
+      size_t const parent = path(table.parent(id));
+      size_t const name = string(table.filename(id));
+      path_data_.fixed(parent, 4);
+      path_data_.fixed(name, 4);
+      index = path_base_ + ++new_paths_;
+    }
+    paths_[id] = index;
+    return index;
+  }
+
+  size_t path(boost::filesystem::path const &value) {
+    return path(PathTable::get().intern(value));
+  }
+
+  size_t hash(Hash const &value) {
+    boost::unordered_map<Hash, size_t>::const_iterator where =
+        hashes_.find(value);
+    if (where != hashes_.end())
+      return where->second;
+    size_t index;
+    if (not base_ or not base_->find_hash(value, index)) {
+      hash_data_.bytes(value.data(), value.size());
+      index = hash_base_ + new_hashes_++;
+    }
+    hashes_[value] = index;
+    return index;
+  }
+
+  size_t hash_count() const { return hash_base_ + new_hashes_; }
+
+  /* the dictionary sections holding new entries */
+  void write(sections_type &sections, hash_algorithm_type algorithm) const {
+    if (string_data_.size()) {
+      sections.push_back(std::make_pair(STRINGS, Output()));
+      string_data_.write(sections.back().second);
+    }
+    if (new_paths_) {
+      sections.push_back(std::make_pair(PATHS, Output()));
+      Output &out = sections.back().second;
+      out.fixed(new_paths_, 8);
+      out.bytes(path_data_.data().data(), path_data_.data().size());
+    }
+    if (new_hashes_ or not base_) {
+      sections.push_back(std::make_pair(HASHES, Output()));
+      Output &out = sections.back().second;
+      out.byte(algorithm);
+      out.bytes(hash_data_.data().data(), hash_data_.data().size());
+    }
+  }
+};
+
+/* a snapshot as indices in the dictionaries: path and hash of each vertex,
+ * and the edges between vertex numbers, sorted */
+struct Snapshot {
+  typedef std::vector<std::pair<unsigned, unsigned> > edges_type;
+
+  std::vector<size_t> paths, hashes;
+  edges_type edges;
+
+  size_t size() const { return paths.size(); }
+
+  void swap(Snapshot &other) {
+    paths.swap(other.paths);
+    hashes.swap(other.hashes);
+    edges.swap(other.edges);
+  }
+};
+
+void sort_edges(Snapshot::edges_type &edges) {
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+}
+
+void extract_snapshot(Snapshot &snapshot, Dictionary &dict,
+                      Graph const &graph) {
+  for (Graph::vertex_iterator v = graph.begin(), vend = graph.end(); v != vend;
+       ++v) {
+    snapshot.paths.push_back(dict.path(graph.id(*v)));
+    snapshot.hashes.push_back(dict.hash(graph.hash(*v)));
+    for (Graph::edge_iterator e = graph.edge_begin(*v),
+                              eend = graph.edge_end(*v);
+         e != eend; ++e)
+      snapshot.edges.push_back(
+          std::make_pair(*v, boost::target(*e, graph.graph())));
+  }
+  sort_edges(snapshot.edges);
+}
+
+void write_snapshot(Output &out, Snapshot const &snapshot) {
+  out.varint(snapshot.size());
+  for (size_t v = 0; v < snapshot.size(); ++v) {
+    out.varint(snapshot.paths[v]);
+    out.varint(snapshot.hashes[v]);
+  }
+  std::vector<size_t> degrees(snapshot.size(), 0);
+  for (size_t e = 0; e < snapshot.edges.size(); ++e)
+    ++degrees[snapshot.edges[e].first];
+  for (size_t v = 0; v < snapshot.size(); ++v)
+    out.varint(degrees[v]);
+  for (size_t e = 0; e < snapshot.edges.size(); ++e)
+    out.varint(snapshot.edges[e].second);
+}
+
+// ``path_bound'' and ``hash_bound'' bound the indices in the dictionaries
+void read_snapshot(Input &in, size_t path_bound, size_t hash_bound,
+                   Snapshot &snapshot) {
+  size_t const size = in.varint();
+  snapshot.paths.resize(size);
+  snapshot.hashes.resize(size);
+  for (size_t v = 0; v < size; ++v) {
+    snapshot.paths[v] = in.index(path_bound);
+    snapshot.hashes[v] = in.index(hash_bound);
+  }
+  std::vector<size_t> degrees(size);
+  for (size_t v = 0; v < size; ++v)
+    degrees[v] = in.varint();
+  for (size_t v = 0; v < size; ++v)
+    for (size_t e = 0; e < degrees[v]; ++e)
+      snapshot.edges.push_back(std::make_pair(v, in.index(size)));
+  sort_edges(snapshot.edges);
+}
+
+// sorted edges, each source written as the gap from the previous one
+void write_edges(Output &out, Snapshot::edges_type const &edges) {
+  out.varint(edges.size());
+  unsigned source = 0;
+  for (size_t e = 0; e < edges.size(); ++e) {
+    out.varint(edges[e].first - source);
+    out.varint(edges[e].second);
+    source = edges[e].first;
+  }
+}
+
+void read_edges(Input &in, size_t size, Snapshot::edges_type &edges) {
+  size_t const count = in.varint();
+  unsigned source = 0;
+  for (size_t e = 0; e < count; ++e) {
+    source += in.index(size - source);
+    edges.push_back(std::make_pair(source, in.index(size)));
+  }
+  sort_edges(edges);
+}
+
+// the changes from ``base'' to ``snapshot'': removed vertices, added ones,
+// hash changes and edge changes. Once applied, the vertices kept come first,
+// in their order in ``base'', then the added ones. The hash and edge changes
+// refer to that numbering
+void write_delta(Output &out, Snapshot const &base, Snapshot const &snapshot) {
+  boost::unordered_map<size_t, unsigned> base_vertices;
+  for (size_t b = 0; b < base.size(); ++b)
+    base_vertices[base.paths[b]] = b;
+  std::vector<int> found(snapshot.size(), -1);
+  std::vector<bool> kept(base.size(), false);
+  size_t kept_count = 0;
+  for (size_t v = 0; v < snapshot.size(); ++v) {
+    boost::unordered_map<size_t, unsigned>::const_iterator where =
+        base_vertices.find(snapshot.paths[v]);
+    if (where != base_vertices.end()) {
+      kept[found[v] = where->second] = true;
+      ++kept_count;
+    }
+  }
+
+  /* removed vertices, as gaps between their numbers */
+  std::vector<int> base_renumbered(base.size(), -1);
+  out.varint(base.size() - kept_count);
+  size_t next = 0, previous = 0;
+  for (size_t b = 0; b < base.size(); ++b) {
+    if (kept[b])
+      base_renumbered[b] = next++;
+    else {
+      out.varint(b - previous);
+      previous = b;
+    }
+  }
+  std::vector<unsigned> renumbered(snapshot.size());
+  out.varint(snapshot.size() - kept_count);
+  for (size_t v = 0; v < snapshot.size(); ++v) {
+    if (found[v] >= 0)
+      renumbered[v] = base_renumbered[found[v]];
+    else {
+      renumbered[v] = next++;
+      out.varint(snapshot.paths[v]);
+      out.varint(snapshot.hashes[v]);
+    }
+  }
+
+  std::map<unsigned, size_t> changed;
+  for (size_t v = 0; v < snapshot.size(); ++v)
+    if (found[v] >= 0 and snapshot.hashes[v] != base.hashes[found[v]])
+      changed[renumbered[v]] = snapshot.hashes[v];
+  out.varint(changed.size());
+  previous = 0;
+  for (std::map<unsigned, size_t>::const_iterator iter = changed.begin(),
+                                                  end = changed.end();
+       iter != end; ++iter) {
+    out.varint(iter->first - previous);
+    out.varint(iter->second);
+    previous = iter->first;
+  }
+
+  Snapshot::edges_type base_edges, edges, removed, added;
+  for (size_t e = 0; e < base.edges.size(); ++e) {
+    int const source = base_renumbered[base.edges[e].first],
+              target = base_renumbered[base.edges[e].second];
+    if (source >= 0 and target >= 0)
+      base_edges.push_back(std::make_pair(source, target));
+  }
+  for (size_t e = 0; e < snapshot.edges.size(); ++e)
+    edges.push_back(std::make_pair(renumbered[snapshot.edges[e].first],
+                                   renumbered[snapshot.edges[e].second]));
+  sort_edges(edges);
+  std::set_difference(base_edges.begin(), base_edges.end(), edges.begin(),
+                      edges.end(), std::back_inserter(removed));
+  std::set_difference(edges.begin(), edges.end(), base_edges.begin(),
+                      base_edges.end(), std::back_inserter(added));
+  write_edges(out, removed);
+  write_edges(out, added);
+}
+
+// turns ``snapshot'' into the one a delta written by write_delta leads to
+void read_delta(Input &in, size_t path_bound, size_t hash_bound,
+                Snapshot &snapshot) {
+  size_t const base_size = snapshot.size();
+  std::vector<int> renumbered(base_size, 0);
+  size_t const removed_count = in.index(base_size + 1);
+  for (size_t i = 0, b = 0; i < removed_count; ++i) {
+    b += in.index(base_size - b);
+    if (i > 0 and renumbered[b] < 0)
+      throw std::runtime_error("corrupted database");
+    renumbered[b] = -1;
+  }
+  Snapshot result;
+  for (size_t b = 0; b < base_size; ++b) {
+    if (renumbered[b] < 0)
+      continue;
+    renumbered[b] = result.size();
+    result.paths.push_back(snapshot.paths[b]);
+    result.hashes.push_back(snapshot.hashes[b]);
+  }
+  size_t const added_count = in.varint();
+  for (size_t i = 0; i < added_count; ++i) {
+    result.paths.push_back(in.index(path_bound));
+    result.hashes.push_back(in.index(hash_bound));
+  }
+  size_t const size = result.size();
+
+  size_t const changed_count = in.varint();
+  for (size_t i = 0, v = 0; i < changed_count; ++i) {
+    v += in.index(size - v);
+    result.hashes[v] = in.index(hash_bound);
+  }
+
+  Snapshot::edges_type base_edges, removed, added, edges;
+  for (size_t e = 0; e < snapshot.edges.size(); ++e) {
+    int const source = renumbered[snapshot.edges[e].first],
+              target = renumbered[snapshot.edges[e].second];
+    if (source >= 0 and target >= 0)
+      base_edges.push_back(std::make_pair(source, target));
+  }
+  read_edges(in, size, removed);
+  read_edges(in, size, added);
+  std::set_difference(base_edges.begin(), base_edges.end(), removed.begin(),
+                      removed.end(), std::back_inserter(edges));
+  std::set_union(edges.begin(), edges.end(), added.begin(), added.end(),
+                 std::back_inserter(result.edges));
+  snapshot.swap(result);
+}
+
+void write_symbols(Output &out, Dictionary &dict,
+                   boost::unordered_set<std::string> const &symbols) {
+  out.varint(symbols.size());
+  BOOST_FOREACH(std::string const & symbol, symbols)
+    out.varint(dict.string(symbol));
+}
+
+// the entries by index of their hash, the hash itself is implicit. The ones
+// ``base'' already holds are skipped
+void write_metadata(std::map<size_t, std::string> &entries, Dictionary &dict,
+                    Metadata const &metadata, database::Reader const *base) {
+  for (Metadata::const_iterator iter = metadata.begin(), end = metadata.end();
+       iter != end; ++iter) {
+    MetadataInfo const &info = iter->second;
+    size_t const index = dict.hash(info.hash());
+    if (base and index < base->hash_count() and base->has_metadata(index))
+      continue;
+    Output out;
+    out.varint(dict.string(info.name()));
+    out.varint(dict.string(info.version()));
+    write_symbols(out, dict, info.exported_symbols());
+    write_symbols(out, dict, info.imported_symbols());
+    out.varint(info.hardening_features().size());
+    BOOST_FOREACH(MetadataInfo::hardening_feature_t feature,
+                  info.hardening_features())
+      out.varint(feature);
+    entries[index] = out.data();
+  }
+}
+
+/* the paths, hashes and strings the sections written by encode() may refer
+ * to, for Reader::index() */
+struct Wanted {
+  std::vector<path_id> paths;
+  std::vector<Hash> hashes;
+  std::vector<std::string> strings;
+
+  void add(Graph const &graph) {
+    for (Graph::vertex_iterator v = graph.begin(), vend = graph.end();
+         v != vend; ++v) {
+      paths.push_back(graph.id(*v));
+      hashes.push_back(graph.hash(*v));
+    }
+  }
+
+  void add(Metadata const &metadata) {
+    for (Metadata::const_iterator iter = metadata.begin(), end = metadata.end();
+         iter != end; ++iter) {
+      MetadataInfo const &info = iter->second;
+      hashes.push_back(info.hash());
+      strings.push_back(info.name());
+      strings.push_back(info.version());
+      strings.insert(strings.end(), info.exported_symbols().begin(),
+                     info.exported_symbols().end());
+      strings.insert(strings.end(), info.imported_symbols().begin(),
+                     info.imported_symbols().end());
+    }
+  }
+
+  void add(StatCache const &cache) {
+    PathTable &table = PathTable::get();
+    for (StatCache::const_iterator iter = cache.begin(), end = cache.end();
+         iter != end; ++iter) {
+      StatCache::Record const &record = iter->second;
+      paths.push_back(table.intern(iter->first));
+      hashes.push_back(record.hash);
+      BOOST_FOREACH(boost::filesystem::path const & dep, record.deps)
+        paths.push_back(table.intern(dep));
+      strings.push_back(record.error);
+    }
+  }
+};
+
+void write_stats(Output &out, Dictionary &dict, StatCache const &cache) {
+  out.varint(cache.size());
+  for (StatCache::const_iterator iter = cache.begin(), end = cache.end();
+       iter != end; ++iter) {
+    StatCache::Record const &record = iter->second;
+    out.varint(dict.path(iter->first));
+    out.fixed(record.stat.device, 8);
+    out.fixed(record.stat.inode, 8);
+    out.fixed(record.stat.size, 8);
+    out.fixed(record.stat.mtime_ns, 8);
+    out.fixed(record.stat.ctime_ns, 8);
+    out.byte((record.handled ? 1 : 0) | (record.has_metadata ? 2 : 0));
+    out.varint(dict.hash(record.hash));
+    out.varint(record.deps.size());
+    BOOST_FOREACH(boost::filesystem::path const & dep, record.deps)
+      out.varint(dict.path(dep));
+    out.varint(dict.string(record.error));
+  }
+}
+
+// encodes the snapshots ``keys'' of ``blobmap'', its metadata and, if
+// ``stats'' is set, its stat cache, ``positions'' telling where each
+// snapshot lands in ``sections''. The dictionary entries and metadata
+// ``base'' holds are not written again, only the entries these sections need
+// are looked for there. The sections that depend on the dictionaries are
+// encoded first, the dictionaries are complete then.
+//
+// A snapshot is written as a delta against the previous one, unless that
+// one ends a chain of CHECKPOINT_INTERVAL - 1 deltas or the delta turns out
+// larger than the snapshot itself. The previous snapshot is kept as it
+// decodes, so the next delta refers to the same vertex numbers
+void encode(BlobMap const &blobmap, std::vector<time_t> const &keys,
+            bool stats, database::Reader *base, sections_type &sections,
+            std::vector<size_t> &positions) {
+  Dictionary dict(base);
+  std::vector<time_t> const all(blobmap.kbegin(), blobmap.kend());
+  if (base) {
+    Wanted wanted;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      std::vector<time_t>::const_iterator where =
+          std::lower_bound(all.begin(), all.end(), keys[i]);
+      if (where != all.begin() and (i == 0 or *(where - 1) != keys[i - 1]))
+        wanted.add(*blobmap[*(where - 1)]);
+      wanted.add(*blobmap[keys[i]]);
+    }
+    wanted.add(*blobmap.metadata());
+    if (stats)
+      wanted.add(blobmap.stat_cache());
+    base->index(wanted.paths, wanted.hashes, wanted.strings);
+  }
+  std::vector<std::pair<boost::uint32_t, Output> > snapshots(keys.size());
+  Snapshot previous;
+  size_t depth = CHECKPOINT_INTERVAL;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    std::vector<time_t>::const_iterator where =
+        std::lower_bound(all.begin(), all.end(), keys[i]);
+    if (where == all.begin())
+      depth = CHECKPOINT_INTERVAL;
+    else if (i == 0 or *(where - 1) != keys[i - 1]) {
+      /* the previous snapshot is in the database */
+      depth = base->delta_depth(*(where - 1));
+      Snapshot().swap(previous);
+      extract_snapshot(previous, dict, *blobmap[*(where - 1)]);
+    }
+
+    Snapshot snapshot;
+    extract_snapshot(snapshot, dict, *blobmap[keys[i]]);
+    snapshots[i].first = SNAPSHOT;
+    write_snapshot(snapshots[i].second, snapshot);
+    if (depth + 1 < CHECKPOINT_INTERVAL) {
+      Output delta;
+      delta.fixed(boost::uint64_t(boost::int64_t(*(where - 1))), 8);
+      write_delta(delta, previous, snapshot);
+      if (delta.data().size() < snapshots[i].second.data().size()) {
+        Input in(delta.data().data() + 8, delta.data().size() - 8);
+        read_delta(in, size_t(-1), size_t(-1), previous);
+        snapshots[i].first = DELTA;
+        snapshots[i].second.swap(delta);
+        ++depth;
+        continue;
+      }
+    }
+    previous.swap(snapshot);
+    depth = 0;
+  }
+  std::map<size_t, std::string> entries;
+  write_metadata(entries, dict, *blobmap.metadata(), base);
+  Output stat_data;
+  if (stats)
+    write_stats(stat_data, dict, blobmap.stat_cache());
+
+  dict.write(sections, blobmap.hash_algorithm());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    positions.push_back(sections.size());
+    sections.push_back(std::make_pair(snapshots[i].first, Output()));
+    sections.back().second.swap(snapshots[i].second);
+  }
+  if (not entries.empty()) {
+    size_t const first = entries.begin()->first;
+    Table table;
+    for (size_t i = first; i <= entries.rbegin()->first; ++i)
+      table.add(entries[i]);
+    sections.push_back(std::make_pair(METADATA, Output()));
+    sections.back().second.fixed(first, 8);
+    table.write(sections.back().second);
+  }
+  if (stats) {
+    sections.push_back(std::make_pair(STATS, Output()));
+    sections.back().second.swap(stat_data);
+  }
+}
+
+void write_catalog(sections_type &sections,
+                   std::map<time_t, size_t> const &catalog) {
+  sections.push_back(std::make_pair(CATALOG, Output()));
+  Output &out = sections.back().second;
+  out.varint(catalog.size());
+  for (std::map<time_t, size_t>::const_iterator iter = catalog.begin(),
+                                                end = catalog.end();
+       iter != end; ++iter) {
+    out.fixed(boost::uint64_t(boost::int64_t(iter->first)), 8);
+    out.varint(iter->second);
+  }
+}
+
+// compresses with ``codec'' the sections it makes smaller, ``flags''
+// telling which ones. A compressed section starts with its size once
+// decompressed, then its head left plain, then the compressed rest
+void compress_sections(sections_type &sections, database::codec_type codec,
+                       std::vector<boost::uint32_t> &flags) {
+  flags.assign(sections.size(), 0);
+  if (codec == database::no_codec)
+    return;
+  for (size_t i = 0; i < sections.size(); ++i) {
+    std::string const &data = sections[i].second.data();
+    size_t const head = std::min(head_size(sections[i].first), data.size());
+    std::string compressed;
+    if (not CODECS[codec].compress(data.data() + head, data.size() - head,
+                                   compressed) or
+        compressed.size() + 8 + head >= data.size())
+      continue;
+    Output out;
+    out.fixed(data.size(), 8);
+    out.bytes(data.data(), head);
+    out.bytes(compressed.data(), compressed.size());
+    sections[i].second.swap(out);
+    flags[i] = codec;
+  }
+}
+
+// writes ``sections'' from ``offset'' on, then the section table made of
+// ``table'' and of their locations: returns the offset of the table
+boost::uint64_t write_sections(std::ostream &out, boost::uint64_t offset,
+                               sections_type const &sections,
+                               std::vector<boost::uint32_t> const &flags,
+                               std::vector<Location> &table) {
+  for (size_t i = 0; i < sections.size(); ++i) {
+    std::string const &data = sections[i].second.data();
+    table.push_back(
+        Location(sections[i].first, flags[i], offset, data.size()));
+    out.write(data.data(), data.size());
+    offset += data.size();
+  }
+  Output entries;
+  entries.fixed(table.size(), 4);
+  entries.fixed(0, 4);
+  for (size_t i = 0; i < table.size(); ++i) {
+    entries.fixed(table[i].tag, 4);
+    entries.fixed(table[i].flags, 4);
+    entries.fixed(table[i].offset, 8);
+    entries.fixed(table[i].size, 8);
+  }
+  out.write(entries.data().data(), entries.data().size());
+  return offset;
+}
+
+// flushes to the disk the data written to ``path'', once flushed from its
+// stream. On Windows this is left to the system
+void sync(boost::filesystem::path const &path) {
+#ifndef _WIN32
+  int const fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+  bool const synced = fd >= 0 and ::fsync(fd) == 0;
+  if (fd >= 0)
+    ::close(fd);
+  if (not synced)
+    throw std::runtime_error("cannot sync " + path.string());
+#else
+  (void)path;
+#endif
+}
+
+// flushes to the disk the entries of the directory ``path'', so that a file
+// renamed in it is found there after a crash
+void sync_directory(boost::filesystem::path const &path) {
+#ifndef _WIN32
+  boost::filesystem::path const directory = path.empty() ? "." : path;
+  int const fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  bool const synced = fd >= 0 and ::fsync(fd) == 0;
+  if (fd >= 0)
+    ::close(fd);
+  if (not synced)
+    throw std::runtime_error("cannot sync " + directory.string());
+#else
+  (void)path;
+#endif
+}
+}
+
+namespace database {
+
+bool is_native(char const *data, size_t size) {
+  return size >= sizeof(MAGIC) and
+         std::memcmp(data, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+// the section table comes last, after the sections
+void write(std::ostream &out, BlobMap const &blobmap) {
+  std::vector<time_t> keys(blobmap.kbegin(), blobmap.kend());
+  sections_type sections;
+  std::vector<size_t> positions;
+  encode(blobmap, keys, true, 0, sections, positions);
+  std::map<time_t, size_t> catalog;
+  for (size_t i = 0; i < keys.size(); ++i)
+    catalog[keys[i]] = positions[i];
+  write_catalog(sections, catalog);
+  std::vector<boost::uint32_t> flags;
+  compress_sections(sections, blobmap.codec(), flags);
+
+  boost::uint64_t table_offset = HEADER_SIZE;
+  for (size_t i = 0; i < sections.size(); ++i)
+    table_offset += sections[i].second.data().size();
+  Output header;
+  header.bytes(MAGIC, sizeof(MAGIC));
+  header.fixed(VERSION, 4);
+  header.fixed(0, 4);
+  header.fixed(table_offset, 8);
+  out.write(header.data().data(), header.data().size());
+  std::vector<Location> table;
+  write_sections(out, HEADER_SIZE, sections, flags, table);
+}
+
+// the new sections and section table are written after the end of the
+// database, which stays consistent until the header points to the new table:
+// they reach the disk before the header is written, and the header before
+// the database is used again
+void append(boost::filesystem::path const &path, Reader &base,
+            BlobMap const &blobmap, bool stat_cache) {
+  std::vector<time_t> keys;
+  for (MapKeyIterator<BlobMap::graph_map_t> iter = blobmap.kbegin(),
+                                            end = blobmap.kend();
+       iter != end; ++iter)
+    if (not base.has(*iter))
+      keys.push_back(*iter);
+  if (keys.empty() and not stat_cache)
+    return;
+
+  /* the sections kept, the superseded ones left aside */
+  std::vector<Location> table;
+  std::vector<size_t> kept(base.sections_.size());
+  for (size_t i = 0; i < base.sections_.size(); ++i) {
+    boost::uint32_t const tag = base.sections_[i].first;
+    if (tag == CATALOG or (stat_cache and tag == STATS))
+      continue;
+    Section const &section = base.sections_[i].second;
+    kept[i] = table.size();
+    table.push_back(Location(tag, base.flags_[i],
+                             section.data - base.content_->data(),
+                             section.size));
+  }
+
+  sections_type sections;
+  std::vector<size_t> positions;
+  encode(blobmap, keys, stat_cache, &base, sections, positions);
+  std::map<time_t, size_t> catalog;
+  for (std::map<time_t, size_t>::const_iterator iter = base.snapshots_.begin(),
+                                                end = base.snapshots_.end();
+       iter != end; ++iter)
+    catalog[iter->first] = kept[iter->second];
+  for (size_t i = 0; i < keys.size(); ++i)
+    catalog[keys[i]] = table.size() + positions[i];
+  write_catalog(sections, catalog);
+  std::vector<boost::uint32_t> flags;
+  compress_sections(sections, blobmap.codec(), flags);
+
+  std::fstream file(path.string().c_str(),
+                    std::ios::in | std::ios::out | std::ios::binary);
+  file.seekp(0, std::ios::end);
+  boost::uint64_t const end = file.tellp();
+  boost::uint64_t const table_offset =
+      write_sections(file, end, sections, flags, table);
+  file.flush();
+  if (not file)
+    throw std::runtime_error("cannot write " + path.string());
+  sync(path);
+  Output pointer;
+  pointer.fixed(VERSION, 4);
+  pointer.fixed(0, 4);
+  pointer.fixed(table_offset, 8);
+  file.seekp(sizeof(MAGIC));
+  file.write(pointer.data().data(), pointer.data().size());
+  file.flush();
+  if (not file)
+    throw std::runtime_error("cannot write " + path.string());
+  sync(path);
+}
+
+// the new database is complete on the disk before it takes the place of the
+// previous one
+void replace(boost::filesystem::path const &path, BlobMap const &blobmap) {
+  boost::filesystem::path const tmp_path = path.string() + ".tmp";
+  std::ofstream file(tmp_path.string().c_str(), std::ios::binary);
+  write(file, blobmap);
+  file.close();
+  if (not file)
+    throw std::runtime_error("cannot write " + tmp_path.string());
+  sync(tmp_path);
+  boost::filesystem::rename(tmp_path, path);
+  sync_directory(path.parent_path());
+}
+
+// only the header, the section table, the heads of the dictionaries and the
+// catalog are read, the sizes of the dictionaries are checked so that their
+// entries can be reached blindly
+Reader::Reader(boost::shared_ptr<FileContent const> const &content)
+    : content_(content), hash_algorithm_(sha1_algorithm), string_count_(0),
+      path_count_(0), hash_count_(0) {
+  char const *data = content->data();
+  size_t const size = content->size();
+  Input header(data, size);
+  if (not is_native(header.bytes(sizeof(MAGIC)), sizeof(MAGIC)))
+    throw std::runtime_error("not a binmap database");
+  if (header.fixed(4) > VERSION)
+    throw std::runtime_error("database written by a more recent binmap");
+  header.fixed(4);
+  boost::uint64_t const table_offset = header.fixed(8);
+  if (table_offset > size)
+    throw std::runtime_error("corrupted database");
+
+  Input table(data + table_offset, size - table_offset);
+  size_t const count = table.fixed(4);
+  table.fixed(4);
+  Section catalog;
+  std::vector<size_t> metadata;
+  stats_ = count;
+  for (size_t i = 0; i < count; ++i) {
+    boost::uint32_t const tag = table.fixed(4);
+    boost::uint32_t const flags = table.fixed(4);
+    boost::uint64_t const offset = table.fixed(8), length = table.fixed(8);
+    if ((flags & ~CODEC_MASK) != 0 or offset > size or
+        length > size - offset)
+      throw std::runtime_error("corrupted database");
+    if ((flags & CODEC_MASK) >= CODEC_COUNT)
+      throw std::runtime_error("unknown compression");
+    sections_.push_back(std::make_pair(tag, Section(data + offset, length)));
+    flags_.push_back(flags);
+    decoded_.push_back(boost::shared_ptr<std::string>());
+    if (tag == STATS)
+      stats_ = i;
+    if (tag != STRINGS and tag != PATHS and tag != HASHES and
+        tag != METADATA and tag != CATALOG)
+      continue;
+    if (tag == CATALOG) {
+      catalog = section(i);
+      continue;
+    }
+    Section const head = this->head(i);
+    size_t const raw_size = this->raw_size(i);
+    Segment segment = { i, 0, 0, 0 };
+    if (tag == STRINGS) {
+      segment.first = string_count_;
+      segment.size = table_size(head, raw_size);
+      string_count_ += segment.size;
+      strings_.push_back(segment);
+    } else if (tag == PATHS) {
+      segment.first = path_count_ + 1;
+      segment.size = Input(head).fixed(8);
+      if (segment.size > (raw_size - 8) / 8)
+        throw std::runtime_error("corrupted database");
+      path_count_ += segment.size;
+      paths_.push_back(segment);
+    } else if (tag == HASHES) {
+      boost::uint8_t const algorithm = Input(head).byte();
+      if (algorithm > fast_algorithm or
+          (not hashes_.empty() and algorithm != hash_algorithm_))
+        throw std::runtime_error("unknown hash algorithm");
+      hash_algorithm_ = hash_algorithm_type(algorithm);
+      segment.first = hash_count_;
+      segment.size = (raw_size - 1) / Hash::SIZE;
+      hash_count_ += segment.size;
+      hashes_.push_back(segment);
+    } else
+      metadata.push_back(i);
+  }
+  BOOST_FOREACH(size_t i, metadata) {
+    Section const head = this->head(i);
+    Input in(head);
+    Segment segment = { i, 8, 0, 0 };
+    segment.first = in.fixed(8);
+    segment.size = table_size(Section(head.data + 8, head.size - 8),
+                              raw_size(i) - 8);
+    if (segment.first > hash_count_ or
+        segment.size > hash_count_ - segment.first)
+      throw std::runtime_error("corrupted database");
+    metadata_.push_back(segment);
+  }
+
+  if (catalog.data) {
+    Input in(catalog);
+    size_t const snapshots = in.varint();
+    for (size_t i = 0; i < snapshots; ++i) {
+      time_t const key = time_t(boost::int64_t(in.fixed(8)));
+      size_t const section = in.index(sections_.size());
+      if ((sections_[section].first != SNAPSHOT and
+           sections_[section].first != DELTA) or
+          not snapshots_.insert(std::make_pair(key, section)).second)
+        throw std::runtime_error("corrupted database");
+    }
+  }
+}
+
+void Reader::keys(std::vector<time_t> &keys) const {
+  for (std::map<time_t, size_t>::const_iterator iter = snapshots_.begin(),
+                                                end = snapshots_.end();
+       iter != end; ++iter)
+    keys.push_back(iter->first);
+}
+
+bool Reader::has(time_t key) const {
+  return snapshots_.find(key) != snapshots_.end();
+}
+
+// the deltas lead back to a full snapshot, each one referring to an earlier
+// snapshot so that the chain ends
+void Reader::chain(time_t key, std::vector<size_t> &sections) const {
+  for (;;) {
+    std::map<time_t, size_t>::const_iterator where = snapshots_.find(key);
+    if (where == snapshots_.end())
+      throw std::runtime_error("no graph associated to this key");
+    sections.push_back(where->second);
+    if (sections_[where->second].first == SNAPSHOT)
+      return;
+    time_t const base =
+        time_t(boost::int64_t(Input(head(where->second)).fixed(8)));
+    if (base >= key)
+      throw std::runtime_error("corrupted database");
+    key = base;
+  }
+}
+
+size_t Reader::delta_depth(time_t key) const {
+  std::vector<size_t> sections;
+  chain(key, sections);
+  return sections.size() - 1;
+}
+
+void Reader::graph(time_t key, Graph &graph, Metadata &metadata) {
+  std::vector<size_t> sections;
+  chain(key, sections);
+  Snapshot snapshot;
+  Input first(section(sections.back()));
+  read_snapshot(first, path_count_ + 1, hash_count_, snapshot);
+  for (size_t i = sections.size() - 1; i-- > 0;) {
+    Input in(section(sections[i]));
+    in.fixed(8);
+    read_delta(in, path_count_ + 1, hash_count_, snapshot);
+  }
+
+  std::vector<path_id> paths(snapshot.size());
+  std::vector<Hash> hashes(snapshot.size());
+  // identical files share their hash, its metadata is decoded once
+  boost::unordered_set<size_t> decoded;
+  decoded.reserve(snapshot.size());
+  for (size_t v = 0; v < snapshot.size(); ++v) {
+    paths[v] = path(snapshot.paths[v]);
+    hashes[v] = hash(snapshot.hashes[v]);
+    hash_indices_.insert(std::make_pair(hashes[v], snapshot.hashes[v]));
+    if (decoded.insert(snapshot.hashes[v]).second)
+      decode_metadata(snapshot.hashes[v], metadata);
+  }
+  graph.freeze(
+      boost::make_shared<CompactGraph const>(paths, hashes, snapshot.edges));
+}
+
+void Reader::metadata(Metadata &metadata) {
+  for (size_t i = 0; i < hash_count_; ++i)
+    load_metadata(i, metadata);
+}
+
+void Reader::stat_cache(StatCache &cache, Metadata &metadata) {
+  if (stats_ == sections_.size())
+    return;
+  PathTable &table = PathTable::get();
+  Input in(section(stats_));
+  size_t const count = in.varint();
+  for (size_t i = 0; i < count; ++i) {
+    StatCache::Record record;
+    path_id const id = path(in.index(path_count_ + 1));
+    record.stat.device = in.fixed(8);
+    record.stat.inode = in.fixed(8);
+    record.stat.size = in.fixed(8);
+    record.stat.mtime_ns = in.fixed(8);
+    record.stat.ctime_ns = in.fixed(8);
+    boost::uint8_t const flags = in.byte();
+    record.handled = flags & 1;
+    record.has_metadata = flags & 2;
+    size_t const hash = in.index(hash_count_);
+    record.hash = this->hash(hash);
+    hash_indices_.insert(std::make_pair(record.hash, hash));
+    if (record.has_metadata)
+      load_metadata(hash, metadata);
+    record.deps.resize(in.varint());
+    for (size_t d = 0; d < record.deps.size(); ++d)
+      record.deps[d] = table.path(path(in.index(path_count_ + 1)));
+    record.error = string(in.index(string_count_));
+    cache.insert(table.path(id), record);
+  }
+}
+
+// only the wanted entries are resolved: the paths in one pass over the path
+// entries, each one coming after its parent, the hashes and strings by
+// comparing the stored ones with the wanted ones
+void Reader::index(std::vector<path_id> const &paths,
+                   std::vector<Hash> const &hashes,
+                   std::vector<std::string> const &strings) {
+  PathTable &table = PathTable::get();
+  boost::unordered_set<path_id> wanted_paths;
+  BOOST_FOREACH(path_id id, paths) {
+    while (id != PathTable::root and
+           path_indices_.find(id) == path_indices_.end() and
+           wanted_paths.insert(id).second)
+      id = table.parent(id);
+  }
+  if (path_ids_.empty())
+    path_ids_.assign(path_count_ + 1, PathTable::root);
+  BOOST_FOREACH(Segment const & segment, paths_) {
+    Section const entries = section(segment);
+    for (size_t i = 0; i < segment.size and not wanted_paths.empty(); ++i) {
+      size_t const index = segment.first + i;
+      Input in(entries.data + 8 + 8 * i, 8);
+      size_t const parent = in.fixed(4), name = in.fixed(4);
+      if (parent >= index or name >= string_count_)
+        throw std::runtime_error("corrupted database");
+      if (parent != 0 and path_ids_[parent] == PathTable::root)
+        continue;
+      path_id id;
+      if (table.child(path_ids_[parent], string(name), id) and
+          wanted_paths.erase(id)) {
+        path_ids_[index] = id;
+        path_indices_.insert(std::make_pair(id, index));
+      }
+    }
+  }
+
+  /* the names of the paths missing are wanted too */
+  boost::unordered_set<std::string> wanted_strings;
+  BOOST_FOREACH(path_id id, wanted_paths)
+    wanted_strings.insert(table.filename(id));
+  BOOST_FOREACH(std::string const & value, strings) {
+    if (string_indices_.find(value) == string_indices_.end())
+      wanted_strings.insert(value);
+  }
+  BOOST_FOREACH(Segment const & segment, strings_) {
+    Section const entries = section(segment);
+    for (size_t i = 0; i < segment.size and not wanted_strings.empty(); ++i) {
+      Section const entry = table_entry(entries, segment.size, i);
+      std::string const value(entry.data, entry.size);
+      if (wanted_strings.erase(value))
+        string_indices_.insert(std::make_pair(value, segment.first + i));
+    }
+  }
+
+  boost::unordered_set<Hash> wanted_hashes;
+  BOOST_FOREACH(Hash const & hash, hashes) {
+    if (hash_indices_.find(hash) == hash_indices_.end())
+      wanted_hashes.insert(hash);
+  }
+  BOOST_FOREACH(Segment const & segment, hashes_) {
+    Section const entries = section(segment);
+    for (size_t i = 0; i < segment.size and not wanted_hashes.empty(); ++i) {
+      Hash const value(reinterpret_cast<boost::uint8_t const *>(
+                           entries.data + 1 + Hash::SIZE * i),
+                       Hash::SIZE);
+      if (wanted_hashes.erase(value))
+        hash_indices_.insert(std::make_pair(value, segment.first + i));
+    }
+  }
+}
+
+bool Reader::find_path(path_id id, size_t &index) const {
+  boost::unordered_map<path_id, size_t>::const_iterator where =
+      path_indices_.find(id);
+  if (where == path_indices_.end())
+    return false;
+  index = where->second;
+  return true;
+}
+
+bool Reader::find_hash(Hash const &hash, size_t &index) const {
+  boost::unordered_map<Hash, size_t>::const_iterator where =
+      hash_indices_.find(hash);
+  if (where == hash_indices_.end())
+    return false;
+  index = where->second;
+  return true;
+}
+
+bool Reader::find_string(std::string const &value, size_t &index) const {
+  boost::unordered_map<std::string, size_t>::const_iterator where =
+      string_indices_.find(value);
+  if (where == string_indices_.end())
+    return false;
+  index = where->second;
+  return true;
+}
+
+bool Reader::has_metadata(size_t index) const {
+  BOOST_FOREACH(Segment const & segment, metadata_) {
+    if (index >= segment.first and index - segment.first < segment.size and
+        table_entry(section(segment), segment.size, index - segment.first)
+            .size)
+      return true;
+  }
+  return false;
+}
+
+size_t Reader::raw_size(size_t index) const {
+  Section const &stored = sections_[index].second;
+  if (flags_[index] == 0)
+    return stored.size;
+  boost::uint64_t const size = Input(stored).fixed(8);
+  if (size > std::numeric_limits<size_t>::max() / 2)
+    throw std::runtime_error("corrupted database");
+  return size;
+}
+
+// the head of a compressed section is kept plain after its size
+Section Reader::head(size_t index) const {
+  Section const &stored = sections_[index].second;
+  if (flags_[index] == 0)
+    return stored;
+  size_t const size =
+      std::min(raw_size(index), head_size(sections_[index].first));
+  if (stored.size - 8 < size)
+    throw std::runtime_error("corrupted database");
+  return Section(stored.data + 8, size);
+}
+
+// a compressed section is decompressed the first time it is needed, in a
+// single pass into its final buffer
+Section Reader::section(size_t index) const {
+  Section const &stored = sections_[index].second;
+  if (flags_[index] == 0)
+    return stored;
+  if (not decoded_[index]) {
+    size_t const size = raw_size(index);
+    size_t const head = this->head(index).size;
+    boost::shared_ptr<std::string> data =
+        boost::make_shared<std::string>(size, '\0');
+    std::copy(stored.data + 8, stored.data + 8 + head, data->begin());
+    CODECS[flags_[index] & CODEC_MASK].decompress(
+        stored.data + 8 + head, stored.size - 8 - head, &(*data)[0] + head,
+        size - head);
+    decoded_[index] = data;
+  }
+  return Section(decoded_[index]->data(), decoded_[index]->size());
+}
+
+Section Reader::section(Segment const &segment) const {
+  Section const whole = section(segment.section);
+  return Section(whole.data + segment.offset, whole.size - segment.offset);
+}
+
+std::string Reader::string(size_t index) const {
+  Segment const &segment = find_segment(strings_, index);
+  Section const entry =
+      table_entry(section(segment), segment.size, index - segment.first);
+  return std::string(entry.data, entry.size);
+}
+
+// entries only refer to the ones before them, which bounds the recursion
+path_id Reader::path(size_t index) {
+  if (index == 0)
+    return PathTable::root;
+  if (path_ids_.empty())
+    path_ids_.assign(path_count_ + 1, PathTable::root);
+  if (path_ids_[index] == PathTable::root) {
+    Segment const &segment = find_segment(paths_, index);
+    Input in(section(segment).data + 8 + 8 * (index - segment.first), 8);
+    size_t const parent = in.fixed(4), name = in.fixed(4);
+    if (parent >= index or name >= string_count_)
+      throw std::runtime_error("corrupted database");
+    path_ids_[index] = PathTable::get().intern(path(parent), string(name));
+    path_indices_.insert(std::make_pair(path_ids_[index], index));
+  }
+  return path_ids_[index];
+}
+
+Hash Reader::hash(size_t index) const {
+  Segment const &segment = find_segment(hashes_, index);
+  return Hash(reinterpret_cast<boost::uint8_t const *>(
+                  section(segment).data + 1 +
+                  Hash::SIZE * (index - segment.first)),
+              Hash::SIZE);
+}
+
+void Reader::load_metadata(size_t index, Metadata &metadata) {
+  if (loaded_metadata_.empty())
+    loaded_metadata_.assign(hash_count_, false);
+  if (loaded_metadata_[index])
+    return;
+  loaded_metadata_[index] = true;
+  decode_metadata(index, metadata);
+}
+
+// a hash may have metadata in several segments, they are merged
+void Reader::decode_metadata(size_t index, Metadata &metadata) {
+  BOOST_FOREACH(Segment const & segment, metadata_) {
+    if (index < segment.first or index - segment.first >= segment.size)
+      continue;
+    Section const entry =
+        table_entry(section(segment), segment.size, index - segment.first);
+    if (entry.size == 0)
+      continue;
+    Input in(entry);
+    std::string const name = string(in.index(string_count_));
+    std::string const version = string(in.index(string_count_));
+    MetadataInfo info(hash(index), name, version);
+    size_t const exported = in.varint();
+    for (size_t i = 0; i < exported; ++i)
+      info.add_exported_symbol(string(in.index(string_count_)));
+    size_t const imported = in.varint();
+    for (size_t i = 0; i < imported; ++i)
+      info.add_imported_symbol(string(in.index(string_count_)));
+    size_t const features = in.varint();
+    for (size_t i = 0; i < features; ++i)
+      info.add_hardening_feature(MetadataInfo::hardening_feature_t(
+          in.index(MetadataInfo::PE_GUARD_CF + 1)));
+    metadata.insert(info);
+  }
+}
+}
@@ -0,0 +1,300 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+/* File content shared by the hash and the collectors
+ *
+ * Elsewhere than on Windows, large files are not held in memory: they are
+ * kept open and read on demand, past their first bytes. Mapping them would
+ * cost no memory either, but accessing the pages of a file truncated
+ * meanwhile would raise SIGBUS, so only the files this process owns are
+ * mapped. The other files are read in a buffer.
+ */
+#include "binmap/file_content.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <cstring>
+#include <ciso646>
+
+#ifndef _WIN32
+# include <cerrno>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif
+
+namespace {
+// smaller files are read
+const size_t LARGE_FILE_SIZE = 1 << 20;
+// first bytes of the files read on demand held in memory, they cover the
+// header checked by the collectors
+const size_t PREFIX_SIZE = 1 << 12;
+// read past the size of a file, to find its end without growing the buffer
+const size_t PROBE_SIZE = 1 << 12;
+// bytes of the content read on demand at once by a ContentStream
+const size_t CHUNK_SIZE = 1 << 16;
+}
+
+FileContent::FileContent(boost::filesystem::path const &path,
+                         access_type access)
+    : data_(0), size_(0), length_(0), mapped_(false), streamed_(false),
+      good_(false), path_(path), access_(access), partial_(true), fd_(-1),
+      device_(0), inode_(0) {
+#ifndef _WIN32
+  fd_ = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0)
+    return;
+#endif
+  read_(0);
+}
+
+FileContent::FileContent(boost::filesystem::path const &path, size_t limit,
+                         access_type access)
+    : data_(0), size_(0), length_(0), mapped_(false), streamed_(false),
+      good_(false), path_(path), access_(access), partial_(true), fd_(-1),
+      device_(0), inode_(0) {
+#ifndef _WIN32
+  fd_ = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0)
+    return;
+#endif
+  read_(limit);
+}
+
+FileContent::FileContent(std::vector<char> &buffer)
+    : data_(0), size_(0), length_(0), mapped_(false), streamed_(false),
+      good_(true), access_(safe_access), partial_(false), fd_(-1), device_(0),
+      inode_(0) {
+  buffer_.swap(buffer);
+  if (not buffer_.empty()) {
+    data_ = &buffer_[0];
+    size_ = length_ = buffer_.size();
+  }
+}
+
+FileContent::~FileContent() {
+#ifndef _WIN32
+  if (mapped_)
+    ::munmap(const_cast<char *>(data_), size_);
+#endif
+  close_();
+}
+
+bool FileContent::complete() {
+  if (partial_ and good_)
+    read_(0);
+  return good_;
+}
+
+size_t FileContent::read(boost::uint64_t offset, char *buffer,
+                         size_t count) const {
+  size_t copied = 0;
+  if (offset < size_) {
+    copied = std::min(count, size_t(size_ - offset));
+    std::memcpy(buffer, data_ + offset, copied);
+  }
+#ifndef _WIN32
+  while (streamed_ and copied < count) {
+    ssize_t const read =
+        ::pread(fd_, buffer + copied, count - copied, offset + copied);
+    if (read < 0 and errno == EINTR)
+      continue;
+    if (read <= 0)
+      break;
+    copied += read;
+  }
+#endif
+  return copied;
+}
+
+// appends the rest of the file to the content, or its first ``limit'' bytes
+// if not 0. The file is closed once its end is reached, unless the rest is
+// read on demand
+void FileContent::read_(size_t limit) {
+  good_ = false;
+#ifndef _WIN32
+  struct stat st;
+  if (::fstat(fd_, &st) != 0)
+    return close_();
+  device_ = st.st_dev;
+  inode_ = st.st_ino;
+  size_t const file_size = S_ISREG(st.st_mode) ? st.st_size : 0;
+  if (not limit and file_size >= LARGE_FILE_SIZE) {
+    if (access_ == mapped_access) {
+      void *const address =
+          ::mmap(0, file_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (address != MAP_FAILED) {
+        std::vector<char>().swap(buffer_);
+        data_ = static_cast<char const *>(address);
+        size_ = length_ = file_size;
+        mapped_ = good_ = true;
+        partial_ = false;
+        return close_();
+      }
+    }
+    else {
+      if (not fill_(PREFIX_SIZE, file_size))
+        return;
+      // unless it turned out shorter than expected
+      streamed_ = partial_;
+      partial_ = false;
+      good_ = true;
+      data_ = buffer_.empty() ? 0 : &buffer_[0];
+      size_ = buffer_.size();
+      length_ = streamed_ ? std::max(boost::uint64_t(file_size),
+                                     boost::uint64_t(size_))
+                          : size_;
+      if (not streamed_)
+        close_();
+      return;
+    }
+  }
+  if (not fill_(limit, file_size))
+    return;
+  if (not partial_)
+    close_();
+#else
+  std::ifstream stream(path_.string().c_str(), std::ios_base::binary);
+  if (not stream)
+    return;
+  stream.seekg(buffer_.size());
+  char chunk[8192];
+  while (stream and (not limit or buffer_.size() < limit)) {
+    stream.read(chunk, limit ? std::min(sizeof chunk, limit - buffer_.size())
+                             : sizeof chunk);
+    buffer_.insert(buffer_.end(), chunk, chunk + stream.gcount());
+  }
+  partial_ = not stream.eof();
+  if (not stream.eof() and not limit) {
+    std::vector<char>().swap(buffer_);
+    data_ = 0;
+    size_ = 0;
+    return;
+  }
+#endif
+  good_ = true;
+  data_ = buffer_.empty() ? 0 : &buffer_[0];
+  size_ = length_ = buffer_.size();
+}
+
+#ifndef _WIN32
+// appends the rest of the file, whose size is expected to be ``file_size'',
+// to the buffer, or up to its first ``limit'' bytes if not 0. Returns false,
+// with the content dropped and the file closed, if it cannot be read
+bool FileContent::fill_(size_t limit, size_t file_size) {
+  // the size is only a hint, the file may change while it is read
+  if (not limit)
+    buffer_.reserve(file_size);
+  for (;;) {
+    size_t const offset = buffer_.size();
+    if (limit and offset >= limit)
+      break;
+    // past the size, the file has most probably been read entirely
+    bool const probe = offset >= file_size;
+    char probe_buffer[PROBE_SIZE];
+    size_t chunk = probe ? PROBE_SIZE : file_size - offset;
+    if (limit)
+      chunk = std::min(chunk, limit - offset);
+    if (not probe)
+      buffer_.resize(offset + chunk);
+    ssize_t const count =
+        ::read(fd_, probe ? probe_buffer : &buffer_[offset], chunk);
+    if (count < 0 and errno == EINTR) {
+      buffer_.resize(offset);
+      continue;
+    }
+    if (count < 0) {
+      std::vector<char>().swap(buffer_);
+      data_ = 0;
+      size_ = length_ = 0;
+      close_();
+      return false;
+    }
+    if (probe)
+      buffer_.insert(buffer_.end(), probe_buffer, probe_buffer + count);
+    else
+      buffer_.resize(offset + count);
+    if (count == 0) {
+      partial_ = false;
+      break;
+    }
+  }
+  return true;
+}
+#endif
+
+void FileContent::close_() {
+#ifndef _WIN32
+  if (fd_ >= 0)
+    ::close(fd_);
+  fd_ = -1;
+#endif
+}
+
+ContentStream::Buffer::Buffer(FileContent const &content)
+    : content_(content), offset_(0) {
+  char *begin = const_cast<char *>(content.data());
+  setg(begin, begin, begin + content.size());
+}
+
+// the next chunk of a content read on demand
+ContentStream::Buffer::int_type ContentStream::Buffer::underflow() {
+  if (not content_.streamed())
+    return traits_type::eof();
+  boost::uint64_t const position = offset_ + (egptr() - eback());
+  chunk_.resize(CHUNK_SIZE);
+  size_t const count = content_.read(position, &chunk_[0], chunk_.size());
+  if (count == 0)
+    return traits_type::eof();
+  offset_ = position;
+  setg(&chunk_[0], &chunk_[0], &chunk_[0] + count);
+  return traits_type::to_int_type(*gptr());
+}
+
+ContentStream::Buffer::pos_type
+ContentStream::Buffer::seekoff(off_type off, std::ios_base::seekdir dir,
+                               std::ios_base::openmode which) {
+  if (not(which & std::ios_base::in))
+    return pos_type(off_type(-1));
+  off_type base = 0;
+  if (dir == std::ios_base::cur)
+    base = offset_ + (gptr() - eback());
+  else if (dir == std::ios_base::end)
+    base = content_.length();
+  off_type const position = base + off;
+  if (position < 0 or boost::uint64_t(position) > content_.length())
+    return pos_type(off_type(-1));
+  // outside of the bytes at hand, the next read starts at ``position''
+  if (boost::uint64_t(position) < offset_ or
+      boost::uint64_t(position) > offset_ + (egptr() - eback())) {
+    offset_ = position;
+    setg(eback(), eback(), eback());
+  }
+  else
+    setg(eback(), eback() + (position - offset_), egptr());
+  return pos_type(position);
+}
+
+ContentStream::Buffer::pos_type
+ContentStream::Buffer::seekpos(pos_type pos, std::ios_base::openmode which) {
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+ContentStream::ContentStream(FileContent const &content)
+    : std::istream(0), buffer_(content) {
+  rdbuf(&buffer_);
+}
@@ -15,185 +15,420 @@
 //
 
 #include "binmap/graph.hpp"
+#include "binmap/condensation.hpp"
+#include "binmap/reachability.hpp"
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/graph/breadth_first_search.hpp>
-#include <boost/graph/floyd_warshall_shortest.hpp>
+#include <boost/property_map/function_property_map.hpp>
+#include <algorithm>
+#include <iterator>
 #include <ciso646>
 
-Graph::Graph() : distance_matrix_(0) {}
-
-Graph::~Graph() {
-  if (distance_matrix_) {
-    delete[] distance_matrix_;
-  }
-}
+Graph::Graph() : frozen_(false) {}
 
 bool Graph::has_node(boost::filesystem::path const &path) const {
+  if (frozen_) {
+    vertex_descriptor vd;
+    return compact_->find(path, vd);
+  }
+  path_id id;
+  if (not PathTable::get().find(path, id))
+    return false;
   bool res;
 #pragma omp critical(graph_)
-  res = mapping_.find(path) != mapping_.end();
+  res = mapping_.find(id) != mapping_.end();
   return res;
 }
 
-Hash const &Graph::hash(graph_type::vertex_descriptor vd) const {
+Graph::vertex_descriptor
+Graph::vertex(boost::filesystem::path const &key) const {
+  if (frozen_) {
+    vertex_descriptor vd;
+    if (not compact_->find(key, vd))
+      throw std::out_of_range(key.string());
+    return vd;
+  }
+  path_id id;
+  if (not PathTable::get().find(key, id))
+    throw std::out_of_range(key.string());
+  boost::unordered_map<path_id, mutable_graph_type::vertex_descriptor>::const_iterator where = mapping_.find(id);
+  if(where == mapping_.end())
+    throw std::out_of_range(key.string());
+  return where->second;
+}
+
+Hash const &Graph::hash(vertex_descriptor vd) const {
+  if (frozen_)
+    return compact_->hash(vd);
   return boost::get(boost::vertex_hash_t(), graph_, vd);
 }
 
-boost::filesystem::path const &
-Graph::key(graph_type::vertex_descriptor vd) const {
+boost::filesystem::path Graph::key(vertex_descriptor vd) const {
+  return PathTable::get().path(id(vd));
+}
+
+path_id Graph::id(vertex_descriptor vd) const {
+  if (frozen_)
+    return compact_->id(vd);
   return boost::get(boost::vertex_name_t(), graph_, vd);
 }
 
 Hash const &Graph::hash(boost::filesystem::path const &key) const {
-  if(mapping_.find(key) == mapping_.end())
-    throw std::out_of_range(key.string());
-  return boost::get(boost::vertex_hash_t(), graph_, mapping_.find(key)->second);
+  return hash(vertex(key));
 }
 
 void Graph::successors(successors_type &succs,
                        boost::filesystem::path const &key) const {
-  for (edge_iterator viter = edge_begin(key); viter != edge_end(key); ++viter)
-    succs.insert(this->key(boost::target(*viter, graph_)));
+  graph_type::adjacency_iterator iter, end;
+  for (boost::tie(iter, end) = boost::adjacent_vertices(vertex(key), graph());
+       iter != end; ++iter)
+    succs.insert(this->key(*iter));
 }
 void Graph::predecessors(successors_type &preds,
                          boost::filesystem::path const &key) const {
-  boost::unordered_map<boost::filesystem::path, graph_type::vertex_descriptor>::const_iterator where = mapping_.find(key);
-  if(where == mapping_.end())
-    throw std::out_of_range(key.string());
-
   graph_type::in_edge_iterator in_begin, in_end;
-  for (boost::tie(in_begin, in_end) =
-           boost::in_edges(where->second, graph_);
+  for (boost::tie(in_begin, in_end) = boost::in_edges(vertex(key), graph());
        in_begin != in_end; ++in_begin)
-    preds.insert(this->key(boost::source(*in_begin, graph_)));
-}
-
-Graph::const_hashes_t Graph::hashes() const {
-  return boost::get(boost::vertex_hash_t(), graph_);
+    preds.insert(this->key(boost::source(*in_begin, graph())));
 }
 
 Graph::vertex_iterator Graph::begin() const {
-  return boost::vertices(graph_).first;
+  return vertex_iterator(0);
 }
 
 Graph::vertex_iterator Graph::end() const {
-  return boost::vertices(graph_).second;
+  return vertex_iterator(size());
+}
+
+Graph::graph_type const &Graph::graph() const { return compact().graph(); }
+
+// the compact form of a graph being built is kept until it changes
+CompactGraph const &Graph::compact() const {
+  if (!compact_)
+    compact_.reset(new CompactGraph(
+        graph_, boost::get(boost::vertex_name_t(), graph_),
+        boost::get(boost::vertex_hash_t(), graph_)));
+  return *compact_;
+}
+
+void Graph::freeze() {
+  if (frozen_)
+    return;
+  compact();
+  mutable_graph_type().swap(graph_);
+  boost::unordered_map<path_id, mutable_graph_type::vertex_descriptor>().swap(
+      mapping_);
+  clear_index();
+  frozen_ = true;
+}
+
+void Graph::freeze(boost::shared_ptr<CompactGraph const> const &compact) {
+  mutable_graph_type().swap(graph_);
+  boost::unordered_map<path_id, mutable_graph_type::vertex_descriptor>().swap(
+      mapping_);
+  clear_index();
+  changed();
+  compact_ = compact;
+  frozen_ = true;
+}
+
+bool Graph::frozen() const { return frozen_; }
+
+// rebuild the mutable form of a frozen graph, before changing it
+void Graph::thaw() {
+  if (not frozen_)
+    return;
+  CompactGraph const &compact = *compact_;
+  graph_type const &cgraph = compact.graph();
+  for (vertex_iterator iter = begin(), end = this->end(); iter != end;
+       ++iter) {
+    mutable_graph_type::vertex_descriptor v = boost::add_vertex(graph_);
+    mapping_[compact.id(*iter)] = v;
+    boost::put(boost::vertex_name_t(), graph_, v, compact.id(*iter));
+    boost::put(boost::vertex_hash_t(), graph_, v, compact.hash(*iter));
+    index(compact.id(*iter));
+  }
+  graph_type::edge_iterator eiter, eend;
+  for (boost::tie(eiter, eend) = boost::edges(cgraph); eiter != eend; ++eiter)
+    boost::add_edge(boost::source(*eiter, cgraph), boost::target(*eiter, cgraph),
+                    graph_);
+  frozen_ = false;
 }
 
-Graph::graph_type const &Graph::graph() const { return graph_; }
+// drop everything derived from the structure of the graph
+void Graph::changed() {
+  compact_.reset();
+  reachability_.reset();
+  condensation_.reset();
+}
 
 Graph::edge_iterator
 Graph::edge_begin(boost::filesystem::path const &input_file) const {
-  assert(has_node(input_file));
-  return boost::out_edges(mapping_.find(input_file)->second, graph_).first;
+  return boost::out_edges(vertex(input_file), graph()).first;
 }
 
 Graph::edge_iterator
 Graph::edge_end(boost::filesystem::path const &input_file) const {
-  assert(has_node(input_file));
-  return boost::out_edges(mapping_.find(input_file)->second, graph_).second;
+  return boost::out_edges(vertex(input_file), graph()).second;
 }
 
 Graph::edge_iterator
-Graph::edge_begin(graph_type::vertex_descriptor input) const {
-  return boost::out_edges(input, graph_).first;
+Graph::edge_begin(vertex_descriptor input) const {
+  return boost::out_edges(input, graph()).first;
 }
 
 Graph::edge_iterator
-Graph::edge_end(graph_type::vertex_descriptor input) const {
-  return boost::out_edges(input, graph_).second;
+Graph::edge_end(vertex_descriptor input) const {
+  return boost::out_edges(input, graph()).second;
 }
 
 void Graph::add_edge(boost::filesystem::path const &from,
-                     boost::filesystem::path const &to) {
-  boost::filesystem::path to_path = to;
-  assert(has_node(from));
-  if(not has_node(to)){
-    to_path = add_node(to, (Hash)(to));
-    assert(has_node(to_path));
+                     boost::filesystem::path const &to,
+                     hash_algorithm_type algorithm) {
+  add_edges(from, std::vector<boost::filesystem::path>(1, to), algorithm);
+}
+
+// the targets are resolved first, the missing ones added as nodes, then
+// merged with the sorted targets of the out-edges of ``from'' so that an edge
+// is never added twice
+void Graph::add_edges(boost::filesystem::path const &from,
+                      std::vector<boost::filesystem::path> const &to,
+                      hash_algorithm_type algorithm) {
+  thaw();
+  PathTable &paths = PathTable::get();
+  path_id id;
+  boost::unordered_map<path_id, mutable_graph_type::vertex_descriptor>::
+      const_iterator where;
+  if (not paths.find(from, id) or
+      (where = mapping_.find(id)) == mapping_.end())
+    throw std::out_of_range(from.string());
+  mutable_graph_type::vertex_descriptor const source = where->second;
+
+  std::vector<mutable_graph_type::vertex_descriptor> targets;
+  targets.reserve(to.size());
+  for (std::vector<boost::filesystem::path>::const_iterator iter = to.begin(),
+                                                            end = to.end();
+       iter != end; ++iter) {
+    if (not paths.find(*iter, id) or
+        (where = mapping_.find(id)) == mapping_.end()) {
+      id = paths.intern(add_node(*iter, Hash(*iter, algorithm)));
+      where = mapping_.find(id);
+      assert(where != mapping_.end());
+    }
+    mutable_graph_type::vertex_descriptor const target = where->second;
+    if (target != source)
+      targets.push_back(target);
   }
-  
+  std::sort(targets.begin(), targets.end());
+
+  std::vector<mutable_graph_type::vertex_descriptor> known;
+  mutable_graph_type::adjacency_iterator aiter, aend;
+  for (boost::tie(aiter, aend) = boost::adjacent_vertices(source, graph_);
+       aiter != aend; ++aiter)
+    known.push_back(*aiter);
+  std::sort(known.begin(), known.end());
+
+  std::vector<mutable_graph_type::vertex_descriptor> fresh;
+  std::set_difference(targets.begin(), std::unique(targets.begin(), targets.end()),
+                      known.begin(), known.end(), std::back_inserter(fresh));
+  if (fresh.empty())
+    return;
+
+  for (size_t i = 0; i < fresh.size(); ++i)
+    boost::add_edge(source, fresh[i], graph_);
+  changed();
+}
 
-#pragma omp critical(graph_)
-  
-  if(from != to_path){ 
-    boost::add_edge(mapping_[from], mapping_[to_path], graph_);
+// a copy of the graph, named by paths
+void Graph::archive(archive_graph_type &graph,
+                    archive_mapping_type &mapping) const {
+  for (vertex_iterator iter = begin(), end = this->end(); iter != end;
+       ++iter) {
+    archive_graph_type::vertex_descriptor v = boost::add_vertex(graph);
+    boost::filesystem::path const key = this->key(*iter);
+    mapping[key] = v;
+    boost::put(boost::vertex_name_t(), graph, v, key);
+    boost::put(boost::vertex_hash_t(), graph, v, hash(*iter));
+  }
+  graph_type::edge_iterator eiter, eend;
+  for (boost::tie(eiter, eend) = boost::edges(this->graph()); eiter != eend;
+       ++eiter)
+    boost::add_edge(boost::source(*eiter, this->graph()),
+                    boost::target(*eiter, this->graph()), graph);
+}
+
+// replace the graph by an archived one. Its path map is not needed, the
+// vertices are named
+void Graph::restore(archive_graph_type const &graph) {
+  PathTable &paths = PathTable::get();
+  mutable_graph_type().swap(graph_);
+  mapping_.clear();
+  clear_index();
+  archive_graph_type::vertex_iterator iter, end;
+  for (boost::tie(iter, end) = boost::vertices(graph); iter != end; ++iter) {
+    mutable_graph_type::vertex_descriptor v = boost::add_vertex(graph_);
+    path_id const id =
+        paths.intern(boost::get(boost::vertex_name_t(), graph, *iter));
+    mapping_[id] = v;
+    boost::put(boost::vertex_name_t(), graph_, v, id);
+    boost::put(boost::vertex_hash_t(), graph_, v,
+               boost::get(boost::vertex_hash_t(), graph, *iter));
+    index(id);
+  }
+  archive_graph_type::edge_iterator eiter, eend;
+  for (boost::tie(eiter, eend) = boost::edges(graph); eiter != eend; ++eiter)
+    boost::add_edge(boost::source(*eiter, graph), boost::target(*eiter, graph),
+                    graph_);
+  frozen_ = false;
+  changed();
+}
+
+namespace {
+// name of the nodes of a graph, for write_graphviz
+struct GraphKey {
+  typedef boost::filesystem::path result_type;
+  Graph const *graph_;
+  GraphKey(Graph const &graph) : graph_(&graph) {}
+  result_type operator()(Graph::vertex_descriptor vd) const {
+    return graph_->key(vd);
   }
+};
+
+// labels the nodes like make_label_writer, with their transitive counts
+struct CountsWriter {
+  Graph const *graph_;
+  std::vector<size_t> const *predecessors_, *successors_;
+  CountsWriter(Graph const &graph, std::vector<size_t> const &predecessors,
+               std::vector<size_t> const &successors)
+      : graph_(&graph), predecessors_(&predecessors),
+        successors_(&successors) {}
+  void operator()(std::ostream &out, Graph::vertex_descriptor vd) const {
+    out << "[label=" << boost::escape_dot_string(graph_->key(vd))
+        << ",predecessors=" << (*predecessors_)[vd]
+        << ",successors=" << (*successors_)[vd] << "]";
+  }
+};
 }
 
-void Graph::dot(boost::filesystem::path const &path) const {
+void Graph::dot(boost::filesystem::path const &path, bool counts) const {
   std::ofstream dotfile(path.string().c_str());
+  if (counts) {
+    std::vector<size_t> predecessors, successors;
+    transitive_counts(predecessors, successors);
+#pragma omp critical(graph_)
+    boost::write_graphviz(dotfile, graph(),
+                          CountsWriter(*this, predecessors, successors));
+    return;
+  }
 #pragma omp critical(graph_)
-  boost::write_graphviz(dotfile, graph_, boost::make_label_writer(boost::get(
-                                             boost::vertex_name_t(), graph_)));
+  boost::write_graphviz(
+      dotfile, graph(),
+      boost::make_label_writer(
+          boost::make_function_property_map<vertex_descriptor>(
+              GraphKey(*this))));
 }
 
 bool Graph::has_path(boost::filesystem::path const &from,
                      boost::filesystem::path const &to) const {
-  assert(has_node(from));
-  assert(has_node(to));
-  compute_distance_matrix();
-  graph_type::vertex_descriptor vfrom = mapping_.find(from)->second,
-                                vto = mapping_.find(to)->second;
-  return distance_matrix_[vfrom][vto] != std::numeric_limits<int>::max();
-}
-
-void Graph::compute_distance_matrix() const {
-  if (!distance_matrix_) {
-    boost::static_property_map<int> weight_map(1);
-    distance_matrix_ = new std::vector<int>[boost::num_vertices(graph_)];
-    std::fill(distance_matrix_, distance_matrix_ + boost::num_vertices(graph_),
-              std::vector<int>(boost::num_vertices(graph_)));
-    floyd_warshall_all_pairs_shortest_paths(graph_, distance_matrix_,
-                                            boost::weight_map(weight_map));
+  vertex_descriptor vfrom = vertex(from), vto = vertex(to);
+  compute_reachability();
+  return reachability_->reaches(vfrom, vto);
+}
+
+// the index is shared by the copies of the graph, it is never modified
+void Graph::compute_reachability() const {
+  if (!reachability_) {
+    condensation();
+    reachability_.reset(new Reachability(condensation_));
   }
 }
 
-boost::filesystem::path Graph::add_node(boost::filesystem::path const &input_file,
-                     Hash const &input_hash) {
-  if(not has_node(input_file)){
+// a node is not counted among its own predecessors nor successors, even
+// when it is part of a cycle
+void Graph::transitive_counts(std::vector<size_t> &predecessors,
+                              std::vector<size_t> &successors) const {
+  Condensation const &condensation = this->condensation();
+  std::vector<size_t> descendants, ancestors;
+  condensation.closure_sizes(descendants, ancestors);
+  predecessors.resize(size());
+  successors.resize(size());
+  for (size_t v = 0; v < size(); ++v) {
+    predecessors[v] = ancestors[condensation.component(v)] - 1;
+    successors[v] = descendants[condensation.component(v)] - 1;
+  }
+}
 
-    if (visited_path_.find(input_file.parent_path()) == visited_path_.end()){ //path not parsed yet
-	visited_path_.insert(input_file.parent_path());
-    }
+// shared by the copies of the graph as well
+Condensation const &Graph::condensation() const {
+  if (!condensation_)
+    condensation_.reset(new Condensation(graph()));
+  return *condensation_;
+}
 
+// the name a node is indexed by
+static std::string index_name(path_id id) {
+  return boost::algorithm::to_lower_copy(PathTable::get().filename(id));
+}
 
-    boost::filesystem::path no_path1 = "/.";
-    boost::filesystem::path no_path2 = ".";
-    std::string file = input_file.string();
+// dependencies that could not be located are added under ``/.'' or ``.'',
+// both interned once
+static path_id const unresolved_absolute = PathTable::get().intern("/.");
+static path_id const unresolved_relative = PathTable::get().intern(".");
 
-    if(input_file.parent_path() == no_path1 || input_file.parent_path() == no_path2){
-	boost::unordered_set<boost::filesystem::path>::iterator it_p_;
+bool Graph::unresolved(path_id id) const {
+  path_id const parent = PathTable::get().parent(id);
+  return parent == unresolved_absolute || parent == unresolved_relative;
+}
 
-	for (it_p_=visited_path_.begin(); it_p_!=visited_path_.end();it_p_++){
-		if(*it_p_ != no_path1 && 
-		   *it_p_ != no_path2 &&
-		   has_node(*it_p_ / input_file.filename())){
-			return (*it_p_ / input_file.filename());
-		}
-	}
+void Graph::index(path_id id) {
+  if (unresolved(id))
+    unresolved_[index_name(id)].push_back(id);
+  else
+    resolved_.insert(std::make_pair(index_name(id), id));
+}
+
+void Graph::clear_index() {
+  name_index_type().swap(resolved_);
+  boost::unordered_map<std::string, std::vector<path_id> >().swap(unresolved_);
+}
+
+boost::filesystem::path Graph::add_node(boost::filesystem::path const &input_file,
+                     Hash const &input_hash) {
+  if(not has_node(input_file)){
+    thaw();
+    PathTable &paths = PathTable::get();
+    path_id const id = paths.intern(input_file);
+    std::string const name = index_name(id);
+
+    if(unresolved(id)){
+	name_index_type::const_iterator known = resolved_.find(name);
+	if(known != resolved_.end())
+		return paths.path(known->second);
     }else{
-	boost::filesystem::path known_dll1 = "/."/input_file.filename();
-	boost::filesystem::path known_dll2 = "."/input_file.filename();
-	if(has_node(known_dll1)){ 
-		mapping_[input_file] = mapping_[known_dll1];
-		mapping_.erase(known_dll1);
-		boost::put(boost::vertex_name_t(), graph_, mapping_[input_file], input_file);
-		boost::put(boost::vertex_hash_t(), graph_, mapping_[input_file], input_hash);
-		return input_file;
-	}else if(has_node(known_dll2)){
-		mapping_[input_file] = mapping_[known_dll2];
-		mapping_.erase(known_dll1);
-		boost::put(boost::vertex_name_t(), graph_, mapping_[input_file], input_file);
-		boost::put(boost::vertex_hash_t(), graph_, mapping_[input_file], input_hash);
+	boost::unordered_map<std::string, std::vector<path_id> >::iterator known =
+	    unresolved_.find(name);
+	if(known != unresolved_.end()){
+		path_id const known_dll = known->second.front();
+		known->second.erase(known->second.begin());
+		if(known->second.empty())
+			unresolved_.erase(known);
+		changed();
+		mapping_[id] = mapping_[known_dll];
+		mapping_.erase(known_dll);
+		boost::put(boost::vertex_name_t(), graph_, mapping_[id], id);
+		boost::put(boost::vertex_hash_t(), graph_, mapping_[id], input_hash);
+		index(id);
 		return input_file;
 	}
     }
 
 
-    graph_type::vertex_descriptor v = boost::add_vertex(graph_);
-    mapping_[input_file] = v;
+    mutable_graph_type::vertex_descriptor v = boost::add_vertex(graph_);
+    mapping_[id] = v;
+    index(id);
+    changed();
 
-    boost::put(boost::vertex_name_t(), graph_, v, input_file);
+    boost::put(boost::vertex_name_t(), graph_, v, id);
     boost::put(boost::vertex_hash_t(), graph_, v, input_hash);
   }
   return input_file;
@@ -201,4 +436,6 @@ boost::filesystem::path Graph::add_node(boost::filesystem::path const &input_fil
 
 
 
-size_t Graph::size() const { return boost::num_vertices(graph_); }
+size_t Graph::size() const {
+  return frozen_ ? compact_->size() : boost::num_vertices(graph_);
+}
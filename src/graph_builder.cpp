@@ -0,0 +1,179 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+/* Graph builder fed by several threads
+ *
+ * The builder only numbers nodes and stores edges between numbers: the
+ * graph itself, whose insertions are not thread-safe and may resolve a path
+ * to another one, is only touched by merge().
+ */
+#include "binmap/graph_builder.hpp"
+#include "binmap/graph.hpp"
+#include "binmap/lock.hpp"
+
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+
+#include <algorithm>
+#include <ciso646>
+
+size_t const GraphBuilder::SHARD_COUNT;
+
+struct GraphBuilder::Node {
+  node_type id;
+  Hash hash;
+  bool added; // false if only seen as the target of an edge
+
+  Node() : id(0), added(false) {}
+};
+
+struct GraphBuilder::Shard {
+  boost::unordered_map<path_id, Node> nodes;
+  Lock lock;
+};
+
+namespace {
+// orders node numbers by path
+struct PathLess {
+  std::vector<boost::filesystem::path> const &paths_;
+
+  PathLess(std::vector<boost::filesystem::path> const &paths)
+      : paths_(paths) {}
+
+  bool operator()(GraphBuilder::node_type lhs,
+                  GraphBuilder::node_type rhs) const {
+    return paths_[lhs] < paths_[rhs];
+  }
+};
+}
+
+GraphBuilder::Buffer::Buffer(GraphBuilder &builder) : builder_(builder) {}
+
+GraphBuilder::Buffer::~Buffer() { flush(); }
+
+void GraphBuilder::Buffer::add_edges(path_id from,
+                                     std::vector<path_id> const &to) {
+  node_type const source = builder_.node(from, 0);
+  for (std::vector<path_id>::const_iterator iter = to.begin(), end = to.end();
+       iter != end; ++iter)
+    edges_.push_back(std::make_pair(source, builder_.node(*iter, 0)));
+}
+
+void GraphBuilder::Buffer::flush() {
+  if (edges_.empty())
+    return;
+  builder_.append(edges_);
+  edges_type().swap(edges_);
+}
+
+GraphBuilder::GraphBuilder()
+    : shards_(new Shard[SHARD_COUNT]), next_(0), lock_(new Lock()) {}
+
+GraphBuilder::~GraphBuilder() {}
+
+GraphBuilder::node_type GraphBuilder::add_node(path_id path,
+                                               Hash const &hash) {
+  return node(path, &hash);
+}
+
+size_t GraphBuilder::size() const {
+  node_type size;
+#pragma omp atomic read
+  size = next_;
+  return size;
+}
+
+// number the node of ``path'' if it is new, and set its hash if ``hash'' is
+// given
+GraphBuilder::node_type GraphBuilder::node(path_id path, Hash const *hash) {
+  Shard &shard = shards_[boost::hash<path_id>()(path) % SHARD_COUNT];
+  Lock::Guard guard(shard.lock);
+  std::pair<boost::unordered_map<path_id, Node>::iterator, bool> where =
+      shard.nodes.insert(std::make_pair(path, Node()));
+  Node &node = where.first->second;
+  if (where.second) {
+#pragma omp atomic capture
+    node.id = next_++;
+  }
+  if (hash and (not node.added or *hash < node.hash)) {
+    node.hash = *hash;
+    node.added = true;
+  }
+  return node.id;
+}
+
+void GraphBuilder::append(edges_type const &edges) {
+  Lock::Guard guard(*lock_);
+  edges_.insert(edges_.end(), edges.begin(), edges.end());
+}
+
+void GraphBuilder::merge(Graph &graph, hash_algorithm_type algorithm) const {
+  /* the nodes, by number then ordered by path */
+  PathTable &table = PathTable::get();
+  std::vector<boost::filesystem::path> paths(next_);
+  std::vector<Node const *> nodes(next_);
+  for (size_t shard = 0; shard < SHARD_COUNT; ++shard) {
+    for (boost::unordered_map<path_id, Node>::const_iterator
+             iter = shards_[shard].nodes.begin(),
+             end = shards_[shard].nodes.end();
+         iter != end; ++iter) {
+      paths[iter->second.id] = table.path(iter->first);
+      nodes[iter->second.id] = &iter->second;
+    }
+  }
+  std::vector<node_type> order(next_), rank(next_);
+  for (node_type id = 0; id < next_; ++id)
+    order[id] = id;
+  std::sort(order.begin(), order.end(), PathLess(paths));
+  for (node_type i = 0; i < next_; ++i)
+    rank[order[i]] = i;
+
+  /* the nodes added first, so that the graph resolves the other ones to
+   * them */
+  std::vector<boost::filesystem::path> names(next_);
+  for (node_type i = 0; i < next_; ++i) {
+    node_type const id = order[i];
+    if (nodes[id]->added)
+      names[id] = graph.add_node(paths[id], nodes[id]->hash);
+  }
+  for (node_type i = 0; i < next_; ++i) {
+    node_type const id = order[i];
+    if (nodes[id]->added)
+      continue;
+    names[id] = graph.has_node(paths[id])
+                    ? paths[id]
+                    : graph.add_node(paths[id], Hash(paths[id], algorithm));
+  }
+
+  /* the edges, by rank of their ends */
+  edges_type edges;
+  edges.reserve(edges_.size());
+  for (edges_type::const_iterator iter = edges_.begin(), end = edges_.end();
+       iter != end; ++iter)
+    edges.push_back(std::make_pair(rank[iter->first], rank[iter->second]));
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+  std::vector<boost::filesystem::path> targets;
+  for (edges_type::const_iterator iter = edges.begin(), end = edges.end();
+       iter != end;) {
+    node_type const source = iter->first;
+    targets.clear();
+    for (; iter != end and iter->first == source; ++iter)
+      targets.push_back(names[order[iter->second]]);
+    graph.add_edges(names[order[source]], targets, algorithm);
+  }
+}
@@ -15,124 +15,377 @@
 //
 
 #include "binmap/hash.hpp"
+#include "binmap/file_content.hpp"
 #include "binmap/log.hpp"
 
 #ifdef _WIN32
 # include <Windows.h>
 # include <wincrypt.h>
 #else
-# include <openssl/sha.h>
+# include <openssl/evp.h>
 #endif
 
 #include <boost/filesystem/operations.hpp>
-#include <fstream>
-#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include <cstring>
 
-static const size_t BUFFER_SIZE = 8192;
-static const size_t DIGEST_SIZE = 20;
+static const size_t DIGEST_SIZE = Hash::SIZE;
+// bytes of a streamed file hashed at once
+static const size_t STREAM_CHUNK_SIZE = 1 << 16;
+static char const hex_digits[] = "0123456789abcdef";
 
-Hash::Hash() {}
+static char const *const algorithm_names[] = { "sha1", "sha256", "fast" };
+
+char const *hash_algorithm_name(hash_algorithm_type algorithm) {
+    return algorithm_names[algorithm];
+}
+
+bool parse_hash_algorithm(std::string const &name,
+                          hash_algorithm_type &algorithm) {
+    for (int i = 0; i <= fast_algorithm; i++) {
+        if (name == algorithm_names[i]) {
+            algorithm = static_cast<hash_algorithm_type>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+Hash::Hash() { digest_.fill(0); }
 
 namespace {
-    template <class Stream>
-    void digest_stream(unsigned char digest[DIGEST_SIZE], Stream &s) {
-        char buf[BUFFER_SIZE];
-#ifdef WIN32
-        HCRYPTPROV prov;
-        HCRYPTHASH hash;
-
-        if (!CryptAcquireContext(&prov, NULL, NULL, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT)){
-            logging::log(logging::error) << "digest_stream: error CryptAcquireContext" << std::endl;
+    /* XXH64, as specified by the xxHash project, computed incrementally */
+    class FastDigest {
+        static const boost::uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+        static const boost::uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+        static const boost::uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+        static const boost::uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+        static const boost::uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+        static const size_t STRIPE = 32;
+
+        boost::uint64_t lanes_[4];
+        boost::uint64_t length_;
+        unsigned char pending_[STRIPE];
+        size_t pending_size_;
+
+        static boost::uint64_t rotl(boost::uint64_t value, int bits) {
+            return (value << bits) | (value >> (64 - bits));
         }
 
-        if (!CryptCreateHash(prov, CALG_SHA1, 0, 0, &hash)){
-            logging::log(logging::error) << "digest_stream: error CryptCreateHash" << std::endl;
+        static boost::uint64_t read64(unsigned char const *p) {
+            boost::uint64_t value = 0;
+            for (int i = 7; i >= 0; i--)
+                value = value << 8 | p[i];
+            return value;
         }
 
-        while (s) {
-            s.read(buf, sizeof buf);
-            std::streamsize extracted = s.gcount();
-            if (!CryptHashData(hash, reinterpret_cast<unsigned char *>(buf),
-                static_cast<DWORD>(extracted), 0)){
-                logging::log(logging::error) << "digest_stream: error CryptHashData" << std::endl;
-            }
+        static boost::uint64_t read32(unsigned char const *p) {
+            return boost::uint64_t(p[0]) | boost::uint64_t(p[1]) << 8 |
+                   boost::uint64_t(p[2]) << 16 | boost::uint64_t(p[3]) << 24;
+        }
+
+        static boost::uint64_t round(boost::uint64_t lane,
+                                     boost::uint64_t input) {
+            return rotl(lane + input * PRIME2, 31) * PRIME1;
+        }
+
+        static boost::uint64_t merge(boost::uint64_t hash,
+                                     boost::uint64_t lane) {
+            return (hash ^ round(0, lane)) * PRIME1 + PRIME4;
         }
 
-        //get hash size
-        DWORD digest_len = 0;
-        DWORD dwCount = sizeof(digest_len);
-        if (!CryptGetHashParam(hash, HP_HASHSIZE, reinterpret_cast<BYTE*>(&digest_len), &dwCount, 0)){
-            logging::log(logging::error) << "digest_stream: error CryptGetHashParam" << std::endl;
+        void stripe(unsigned char const *p) {
+            for (int i = 0; i < 4; i++)
+                lanes_[i] = round(lanes_[i], read64(p + 8 * i));
         }
 
-        if (digest_len <= DIGEST_SIZE){
-            //now compute the hash
-            CryptGetHashParam(hash, HP_HASHVAL, digest, &digest_len, 0);
+    public:
+        FastDigest() : length_(0), pending_size_(0) {
+            lanes_[0] = PRIME1 + PRIME2;
+            lanes_[1] = PRIME2;
+            lanes_[2] = 0;
+            lanes_[3] = -PRIME1;
         }
-        else{
-            logging::log(logging::error) << "digest_stream: error, digest is bigger than buffer" << std::endl;
+
+        void update(unsigned char const *data, size_t size) {
+            length_ += size;
+            if (pending_size_) {
+                size_t const fill = std::min(size, STRIPE - pending_size_);
+                std::memcpy(pending_ + pending_size_, data, fill);
+                pending_size_ += fill;
+                data += fill;
+                size -= fill;
+                if (pending_size_ < STRIPE)
+                    return;
+                stripe(pending_);
+                pending_size_ = 0;
+            }
+            for (; size >= STRIPE; data += STRIPE, size -= STRIPE)
+                stripe(data);
+            std::memcpy(pending_, data, size);
+            pending_size_ = size;
+        }
+
+        boost::uint64_t digest() const {
+            boost::uint64_t hash;
+            if (length_ >= STRIPE) {
+                hash = rotl(lanes_[0], 1) + rotl(lanes_[1], 7) +
+                       rotl(lanes_[2], 12) + rotl(lanes_[3], 18);
+                for (int i = 0; i < 4; i++)
+                    hash = merge(hash, lanes_[i]);
+            }
+            else
+                hash = PRIME5;
+            hash += length_;
+
+            unsigned char const *p = pending_, *end = pending_ + pending_size_;
+            for (; p + 8 <= end; p += 8)
+                hash = rotl(hash ^ round(0, read64(p)), 27) * PRIME1 + PRIME4;
+            if (p + 4 <= end) {
+                hash = rotl(hash ^ read32(p) * PRIME1, 23) * PRIME2 + PRIME3;
+                p += 4;
+            }
+            for (; p < end; p++)
+                hash = rotl(hash ^ *p * PRIME5, 11) * PRIME1;
+
+            hash ^= hash >> 33;
+            hash *= PRIME2;
+            hash ^= hash >> 29;
+            hash *= PRIME3;
+            hash ^= hash >> 32;
+            return hash;
         }
 
-        CryptDestroyHash(hash);
+        boost::uint64_t length() const { return length_; }
+    };
+}
+
+#ifdef _WIN32
+struct Hasher::Context {
+    hash_algorithm_type algorithm;
+    HCRYPTPROV prov;
+    HCRYPTHASH hash;
+    FastDigest fast;
+};
+#else
+struct Hasher::Context {
+    hash_algorithm_type algorithm;
+    EVP_MD_CTX *md;
+    FastDigest fast;
+};
+#endif
+
+Hasher::Hasher(hash_algorithm_type algorithm) : context_(new Context()) {
+    initialize(algorithm);
+}
 
-        CryptReleaseContext(prov, 0);
+// the cryptographic digests go through the system library, which picks the
+// fastest implementation for the processor (SHA-NI, AVX2...)
+void Hasher::initialize(hash_algorithm_type algorithm) {
+    context_->algorithm = algorithm;
+#ifdef _WIN32
+    context_->prov = 0;
+    context_->hash = 0;
+    if (algorithm == fast_algorithm)
+        return;
+    if (!CryptAcquireContext(&context_->prov, NULL, NULL, PROV_RSA_AES, CRYPT_VERIFYCONTEXT)){
+        logging::log(logging::error) << "Hasher: error CryptAcquireContext" << std::endl;
+    }
 
+    ALG_ID const id = algorithm == sha256_algorithm ? CALG_SHA_256 : CALG_SHA1;
+    if (!CryptCreateHash(context_->prov, id, 0, 0, &context_->hash)){
+        logging::log(logging::error) << "Hasher: error CryptCreateHash" << std::endl;
+    }
 #else
-        SHA_CTX sc;
-        SHA1_Init(&sc);
+    context_->md = 0;
+    if (algorithm == fast_algorithm)
+        return;
+    context_->md = EVP_MD_CTX_create();
+    if (!context_->md ||
+        !EVP_DigestInit_ex(context_->md, algorithm == sha256_algorithm
+                                             ? EVP_sha256()
+                                             : EVP_sha1(),
+                           NULL)) {
+        logging::log(logging::error) << "Hasher: error EVP_DigestInit_ex" << std::endl;
+    }
+#endif
+}
 
-        while (s) {
-            s.read(buf, sizeof buf);
-            std::streamsize extracted = s.gcount();
-            SHA1_Update(&sc, buf, extracted);
+Hasher::~Hasher() {
+#ifdef _WIN32
+    if (context_->hash)
+        CryptDestroyHash(context_->hash);
+    if (context_->prov)
+        CryptReleaseContext(context_->prov, 0);
+#else
+    if (context_->md)
+        EVP_MD_CTX_destroy(context_->md);
+#endif
+    delete context_;
+}
+
+void Hasher::update(char const *data, size_t size) {
+    if (context_->algorithm == fast_algorithm) {
+        context_->fast.update(reinterpret_cast<unsigned char const *>(data),
+                              size);
+        return;
+    }
+#ifdef _WIN32
+    // CryptHashData takes a DWORD size, whole mapped files may be larger
+    while (size) {
+        DWORD const chunk = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+        if (!CryptHashData(context_->hash, reinterpret_cast<BYTE const *>(data),
+            chunk, 0)){
+            logging::log(logging::error) << "Hasher: error CryptHashData" << std::endl;
         }
-        SHA1_Final(digest, &sc);
+        data += chunk;
+        size -= chunk;
+    }
+#else
+    EVP_DigestUpdate(context_->md, data, size);
 #endif
+}
+
+void Hasher::update(FileContent const &content) {
+    if (!content.streamed())
+        return update(content.data(), content.size());
+    std::vector<char> chunk(STREAM_CHUNK_SIZE);
+    boost::uint64_t offset = 0;
+    while (size_t const read = content.read(offset, &chunk[0], chunk.size())) {
+        update(&chunk[0], read);
+        offset += read;
     }
 }
 
-Hash::Hash(boost::filesystem::path const &filename) {
-    unsigned char digest[DIGEST_SIZE];
-    if (boost::filesystem::exists(filename)) {
-        std::ifstream f(filename.string().c_str());
-        digest_stream(digest, f);
+Hash Hasher::digest() {
+    Hash hash;
+    unsigned char *digest = hash.digest_.c_array();
+
+    // the fast digest is followed by the size, for fewer collisions
+    if (context_->algorithm == fast_algorithm) {
+        boost::uint64_t const values[] = { context_->fast.digest(),
+                                           context_->fast.length() };
+        for (size_t i = 0; i < 16; i++)
+            digest[i] = static_cast<unsigned char>(values[i / 8] >> (56 - 8 * (i % 8)));
+        return hash;
+    }
+
+    // SHA-256 is truncated to the size of a Hash
+    unsigned char full[32];
+#ifdef _WIN32
+    DWORD digest_len = sizeof full;
+    if (!CryptGetHashParam(context_->hash, HP_HASHVAL, full, &digest_len, 0)){
+        logging::log(logging::error) << "Hasher: error CryptGetHashParam" << std::endl;
     }
+#else
+    unsigned int digest_len = sizeof full;
+    if (!EVP_DigestFinal_ex(context_->md, full, &digest_len)) {
+        logging::log(logging::error) << "Hasher: error EVP_DigestFinal_ex" << std::endl;
+    }
+#endif
+    std::memcpy(digest, full, DIGEST_SIZE);
+    return hash;
+}
+
+Hash::Hash(boost::filesystem::path const &filename,
+           hash_algorithm_type algorithm) {
+    // try to read the file first, the existence check is only needed when
+    // this fails. Missing files are identified by their path
+    Hasher hasher(algorithm);
+    FileContent const content(filename);
+    if (content.good() or boost::filesystem::exists(filename))
+        hasher.update(content);
     else {
-        std::istringstream s(filename.string());
-        digest_stream(digest, s);
+        std::string const &name = filename.string();
+        hasher.update(name.data(), name.size());
     }
+    *this = hasher.digest();
+}
 
-    // conversion to string
-    static char out[DIGEST_SIZE * 2 + 1];
+namespace {
+    int hex_value(char c) {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+}
+
+Hash::Hash(boost::uint8_t const *data, size_t size) {
+    if (size != SIZE)
+        throw std::invalid_argument("bad digest size");
+    std::copy(data, data + SIZE, digest_.begin());
+}
+
+Hash::Hash(std::string const &value) {
+    digest_.fill(0);
+    if (value.empty())
+        return;
+    if (value.size() != 2 * DIGEST_SIZE)
+        throw std::invalid_argument("invalid hash: " + value);
     for (size_t i = 0; i < DIGEST_SIZE; i++) {
-        out[2 * i] = "0123456789abcdef"[(digest[i] >> 4) & 0x0F];
-        out[2 * i + 1] = "0123456789abcdef"[(digest[i] >> 0) & 0x0F];
+        int const high = hex_value(value[2 * i]),
+                  low = hex_value(value[2 * i + 1]);
+        if (high < 0 || low < 0)
+            throw std::invalid_argument("invalid hash: " + value);
+        digest_[i] = static_cast<boost::uint8_t>(high << 4 | low);
     }
-    out[DIGEST_SIZE * 2] = 0;
-    digest_ = out;
 }
 
-Hash::Hash(std::string const &value) : digest_(value) {}
+std::string Hash::str() const {
+    if (null())
+        return std::string();
+    char out[DIGEST_SIZE * 2];
+    for (size_t i = 0; i < DIGEST_SIZE; i++) {
+        out[2 * i] = hex_digits[(digest_[i] >> 4) & 0x0F];
+        out[2 * i + 1] = hex_digits[(digest_[i] >> 0) & 0x0F];
+    }
+    return std::string(out, sizeof out);
+}
 
-std::string const &Hash::str() const { return digest_; }
-char const *Hash::c_str() const { return digest_.c_str(); }
+boost::uint8_t const *Hash::data() const { return digest_.data(); }
 
-size_t Hash::size() const { return digest_.size(); }
+size_t Hash::size() const { return DIGEST_SIZE; }
+
+bool Hash::null() const {
+    for (size_t i = 0; i < DIGEST_SIZE; i++) {
+        if (digest_[i])
+            return false;
+    }
+    return true;
+}
 
+// the digests have a fixed size, so that ordering is a single memcmp
 bool Hash::operator<(Hash const &other) const {
-    return digest_ < other.digest_;
+    return std::memcmp(digest_.data(), other.digest_.data(), DIGEST_SIZE) < 0;
 }
 
 bool Hash::operator>(Hash const &other) const {
-    return digest_ > other.digest_;
+    return other < *this;
 }
 
+// equality looks at every byte whatever the first difference, so that its
+// duration does not depend on the digests
 bool Hash::operator==(Hash const &other) const {
-    return digest_ == other.digest_;
+    unsigned char difference = 0;
+    for (size_t i = 0; i < DIGEST_SIZE; ++i)
+      difference |= static_cast<unsigned char>(digest_[i] ^ other.digest_[i]);
+    return difference == 0;
 }
 
 bool Hash::operator!=(Hash const &other) const {
-    return digest_ != other.digest_;
+    return !(*this == other);
+}
+
+std::size_t hash_value(Hash const &hash) {
+    std::size_t value;
+    std::memcpy(&value, hash.data(), sizeof value);
+    return value;
 }
 
 std::ostream &operator<<(std::ostream &oss, Hash const &h) {
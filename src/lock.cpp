@@ -0,0 +1,29 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include "binmap/lock.hpp"
+
+#ifdef _OPENMP
+Lock::Lock() { omp_init_lock(&lock_); }
+Lock::~Lock() { omp_destroy_lock(&lock_); }
+void Lock::acquire() { omp_set_lock(&lock_); }
+void Lock::release() { omp_unset_lock(&lock_); }
+#else
+Lock::Lock() {}
+Lock::~Lock() {}
+void Lock::acquire() {}
+void Lock::release() {}
+#endif
@@ -96,9 +96,8 @@ void MetadataInfo::update(MetadataInfo const &info) {
 Metadata::Metadata() {}
 
 void Metadata::insert(MetadataInfo const &info) {
-  Hash const &hash = info.hash();
-  std::string const& key = hash.str();
-  boost::unordered_map<std::string, MetadataInfo> :: iterator where = db_.find(key);
+  Hash const &key = info.hash();
+  boost::unordered_map<Hash, MetadataInfo> :: iterator where = db_.find(key);
   if (where != db_.end()) {
     where->second.update(info);
   } else {
@@ -107,7 +106,7 @@ void Metadata::insert(MetadataInfo const &info) {
 }
 
 Metadata::value_type Metadata::operator[](key_type const &key) const {
-  boost::unordered_map<std::string, MetadataInfo> :: const_iterator where = db_.find(key.str());
+  boost::unordered_map<Hash, MetadataInfo> :: const_iterator where = db_.find(key);
   if( where != db_.end())
     return where->second;
   else
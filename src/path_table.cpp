@@ -0,0 +1,155 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include "binmap/path_table.hpp"
+#include "binmap/lock.hpp"
+
+#include <boost/functional/hash.hpp>
+
+#include <stdexcept>
+#include <ciso646>
+
+path_id const PathTable::root;
+size_t const PathTable::SHARD_COUNT;
+unsigned const PathTable::CHUNK_BITS;
+size_t const PathTable::CHUNK_SIZE;
+
+struct PathTable::Shard {
+  index_type index;
+  Lock lock;
+};
+
+// the empty path has no entry of its own, it is the parent of the first
+// component of every path
+PathTable::PathTable()
+    : shards_(new Shard[SHARD_COUNT]),
+      chunks_((size_t(path_id(-1)) >> CHUNK_BITS) + 1),
+      size_(1), lock_(new Lock()) {}
+
+// built on first use and never destroyed, like the Env registry, so that it
+// outlives the graphs held by static objects
+PathTable &PathTable::get() {
+  static PathTable *the_table = new PathTable();
+  return *the_table;
+}
+
+PathTable::Shard &PathTable::shard(entry_key const &key) const {
+  return shards_[boost::hash<entry_key>()(key) % SHARD_COUNT];
+}
+
+path_id PathTable::intern(boost::filesystem::path const &path) {
+  path_id id = root;
+  for (boost::filesystem::path::iterator iter = path.begin(), end = path.end();
+       iter != end; ++iter)
+    id = add(id, iter->string());
+  return id;
+}
+
+path_id PathTable::intern(path_id parent, std::string const &name) {
+  if (parent >= size())
+    throw std::out_of_range("unknown path");
+  return add(parent, name);
+}
+
+// the identifier is allocated while the shard lock is held, so that no other
+// thread sees the entry before it is complete
+path_id PathTable::add(path_id parent, std::string const &name) {
+  entry_key const key(parent, name);
+  Shard &owner = shard(key);
+  Lock::Guard guard(owner.lock);
+  std::pair<index_type::iterator, bool> where =
+      owner.index.insert(std::make_pair(key, path_id(0)));
+  if (where.second) {
+    Lock::Guard id_guard(*lock_);
+    if (size_ > path_id(-1)) {
+      owner.index.erase(where.first);
+      throw std::length_error("too many paths");
+    }
+    path_id const id = size_;
+    entry_type const **&chunk = chunks_[id >> CHUNK_BITS];
+    if (not chunk)
+      chunk = new entry_type const *[CHUNK_SIZE];
+    chunk[id & (CHUNK_SIZE - 1)] = &*where.first;
+    where.first->second = id;
+    ++size_;
+  }
+  return where.first->second;
+}
+
+bool PathTable::lookup(path_id parent, std::string const &name,
+                       path_id &id) const {
+  entry_key const key(parent, name);
+  Shard &owner = shard(key);
+  Lock::Guard guard(owner.lock);
+  index_type::const_iterator where = owner.index.find(key);
+  if (where == owner.index.end())
+    return false;
+  id = where->second;
+  return true;
+}
+
+// the entries are never moved nor removed, and an identifier is only known
+// once its entry is written
+PathTable::entry_type const &PathTable::entry(path_id id) const {
+  return *chunks_[id >> CHUNK_BITS][id & (CHUNK_SIZE - 1)];
+}
+
+bool PathTable::find(boost::filesystem::path const &path, path_id &id) const {
+  path_id current = root;
+  for (boost::filesystem::path::iterator iter = path.begin(), end = path.end();
+       iter != end; ++iter) {
+    if (not lookup(current, iter->string(), current))
+      return false;
+  }
+  id = current;
+  return true;
+}
+
+bool PathTable::child(path_id parent, std::string const &name,
+                      path_id &id) const {
+  return lookup(parent, name, id);
+}
+
+// walks up to the root, then appends the components in order
+boost::filesystem::path PathTable::path(path_id id) const {
+  std::vector<std::string const *> components;
+  for (; id != root; id = entry(id).first.first)
+    components.push_back(&entry(id).first.second);
+  boost::filesystem::path result;
+  for (std::vector<std::string const *>::reverse_iterator
+           iter = components.rbegin(),
+           end = components.rend();
+       iter != end; ++iter)
+    result /= **iter;
+  return result;
+}
+
+path_id PathTable::parent(path_id id) const {
+  if (id == root)
+    return root;
+  return entry(id).first.first;
+}
+
+std::string PathTable::filename(path_id id) const {
+  if (id == root)
+    return std::string();
+  return entry(id).first.second;
+}
+
+size_t PathTable::size() const {
+  Lock::Guard guard(*lock_);
+  return size_;
+}
@@ -0,0 +1,58 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include "binmap/queue.hpp"
+
+#include <ostream>
+
+Signal::Signal() : generation_(0), waiting_(0) {}
+
+unsigned long Signal::generation() {
+  boost::mutex::scoped_lock guard(mutex_);
+  return generation_;
+}
+
+// only broadcast when someone is waiting, most changes happen while every
+// thread is busy
+void Signal::notify() {
+  boost::mutex::scoped_lock guard(mutex_);
+  ++generation_;
+  if (waiting_)
+    changed_.notify_all();
+}
+
+void Signal::wait(unsigned long generation) {
+  boost::mutex::scoped_lock guard(mutex_);
+  ++waiting_;
+  while (generation_ == generation)
+    changed_.wait(guard);
+  --waiting_;
+}
+
+QueueStats::QueueStats()
+    : pushed(0), max_depth(0), max_bytes(0), depth_sum(0), full(0),
+      empty(0) {}
+
+double QueueStats::average_depth() const {
+  return pushed ? double(depth_sum) / pushed : 0.;
+}
+
+std::ostream &operator<<(std::ostream &os, QueueStats const &stats) {
+  return os << stats.pushed << " items, depth " << stats.average_depth()
+            << " on average, " << stats.max_depth << " at most, "
+            << stats.max_bytes << " bytes at most, " << stats.full
+            << " times full, " << stats.empty << " times empty";
+}
@@ -0,0 +1,119 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include "binmap/reachability.hpp"
+#include "binmap/condensation.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+// true if ``to'' is reachable from ``from'': the post-order number of the
+// component of ``to'' lies in one of the intervals of the one of ``from''
+bool Reachability::reaches(size_t from, size_t to) const {
+  assert(from < condensation_->vertex_count() and
+         to < condensation_->vertex_count());
+  unsigned const cfrom = condensation_->component(from),
+                 cto = condensation_->component(to);
+  if (cfrom == cto)
+    return true;
+  unsigned const number = order_[cto];
+  std::vector<interval_type>::const_iterator
+      begin = intervals_.begin() + offsets_[cfrom],
+      end = intervals_.begin() + offsets_[cfrom + 1],
+      where = std::upper_bound(begin, end,
+                               interval_type(number, unsigned(-1)));
+  return where != begin and number <= (where - 1)->second;
+}
+
+namespace {
+// sort ``intervals'' and merge the ones that overlap or touch
+void merge_intervals(std::vector<std::pair<unsigned, unsigned> > &intervals) {
+  std::sort(intervals.begin(), intervals.end());
+  size_t last = 0;
+  for (size_t i = 1; i < intervals.size(); ++i) {
+    if (intervals[i].first <= intervals[last].second + 1)
+      intervals[last].second =
+          std::max(intervals[last].second, intervals[i].second);
+    else
+      intervals[++last] = intervals[i];
+  }
+  intervals.resize(std::min(intervals.size(), last + 1));
+}
+}
+
+// labels the components of the condensed graph, which are numbered in
+// topological order
+Reachability::Reachability(
+    boost::shared_ptr<Condensation const> const &condensation)
+    : condensation_(condensation) {
+  size_t const count = condensation_->size();
+
+  /* post-order numbering of a spanning forest, rooted at the sources. The
+   * subtree of a component is numbered from ``low'' to its own number */
+  std::vector<unsigned> low(count);
+  std::vector<bool> seen(count, false);
+  order_.assign(count, 0);
+  unsigned next = 0;
+  std::vector<std::pair<unsigned, size_t> > stack;
+  for (unsigned root = 0; root < count; ++root) {
+    if (seen[root])
+      continue;
+    seen[root] = true;
+    low[root] = next;
+    stack.push_back(std::make_pair(root, 0));
+    while (not stack.empty()) {
+      unsigned const c = stack.back().first;
+      size_t &edge = stack.back().second;
+      Condensation::range_type const succs = condensation_->successors(c);
+      if (edge < size_t(succs.second - succs.first)) {
+        unsigned const succ = succs.first[edge++];
+        if (not seen[succ]) {
+          seen[succ] = true;
+          low[succ] = next;
+          stack.push_back(std::make_pair(succ, 0));
+        }
+      } else {
+        order_[c] = next++;
+        stack.pop_back();
+      }
+    }
+  }
+
+  /* from the sinks up, a component reaches its subtree and everything its
+   * successors reach */
+  std::vector<std::vector<interval_type> > labels(count);
+  for (unsigned c = count; c-- > 0;) {
+    std::vector<interval_type> &label = labels[c];
+    label.push_back(interval_type(low[c], order_[c]));
+    Condensation::range_type const succs = condensation_->successors(c);
+    for (Condensation::iterator iter = succs.first; iter != succs.second;
+         ++iter) {
+      std::vector<interval_type> const &other = labels[*iter];
+      label.insert(label.end(), other.begin(), other.end());
+    }
+    merge_intervals(label);
+  }
+
+  offsets_.resize(count + 1);
+  offsets_[0] = 0;
+  for (size_t c = 0; c < count; ++c)
+    offsets_[c + 1] = offsets_[c] + labels[c].size();
+  intervals_.reserve(offsets_[count]);
+  for (size_t c = 0; c < count; ++c) {
+    intervals_.insert(intervals_.end(), labels[c].begin(), labels[c].end());
+    std::vector<interval_type>().swap(labels[c]);
+  }
+}
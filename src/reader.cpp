@@ -0,0 +1,388 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+/* Batch file reading
+ *
+ * The io_uring reader keeps the open, read and close of many files in flight
+ * at once, reading into buffers registered with the kernel. It talks to the
+ * kernel directly, without liburing. Elsewhere, or when io_uring is not
+ * usable, callers fall back to reading one file after the other.
+ */
+#include "binmap_config.hpp"
+#include "binmap/reader.hpp"
+#include "binmap/log.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <ciso646>
+
+#if BINMAP_IO_URING
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+# include <sys/stat.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <cerrno>
+#endif
+
+ReadConsumer::~ReadConsumer() {}
+
+void ReadConsumer::identity(size_t, boost::uint64_t, boost::uint64_t) {}
+
+BatchReader::~BatchReader() {}
+
+#if BINMAP_IO_URING
+namespace {
+
+/* up to DEPTH files in flight, each one with its own registered buffer */
+class UringReader : public BatchReader {
+  static const unsigned DEPTH = 64;
+  static const size_t CHUNK_SIZE = 64 * 1024;
+
+  enum operation_type { open_operation = 1, read_operation, close_operation };
+
+  struct Slot {
+    size_t index;  // of the file in the batch
+    int fd;
+    size_t offset;
+    bool failed;
+    bool closing; // set once the consumer has been told the file is done
+  };
+
+  int ring_;
+  bool fixed_; // whether the buffers could be registered
+
+  void *sq_ring_, *cq_ring_;
+  size_t sq_ring_size_, cq_ring_size_;
+  io_uring_sqe *sqes_;
+  size_t sqes_size_;
+  unsigned *sq_head_, *sq_tail_, *sq_mask_, *sq_array_;
+  unsigned *cq_head_, *cq_tail_, *cq_mask_;
+  io_uring_cqe *cqes_;
+  unsigned prepared_; // entries filled since the last submission
+
+  std::vector<char> buffers_;
+  Slot slots_[DEPTH];
+
+  UringReader(UringReader const &);
+
+public:
+  UringReader()
+      : ring_(-1), fixed_(false), sq_ring_(MAP_FAILED), cq_ring_(MAP_FAILED),
+        sq_ring_size_(0), cq_ring_size_(0),
+        sqes_(static_cast<io_uring_sqe *>(MAP_FAILED)), sqes_size_(0),
+        prepared_(0) {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring_ = ::syscall(SYS_io_uring_setup, DEPTH, &params);
+    if (ring_ < 0)
+      return;
+    if (not supported()) {
+      ::close(ring_);
+      ring_ = -1;
+      return;
+    }
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool const single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    sq_ring_ = ::mmap(0, sq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_, IORING_OFF_SQ_RING);
+    cq_ring_ = single_mmap
+                   ? sq_ring_
+                   : ::mmap(0, cq_ring_size_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring_,
+                            IORING_OFF_CQ_RING);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(
+        ::mmap(0, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+               ring_, IORING_OFF_SQES));
+    if (sq_ring_ == MAP_FAILED or cq_ring_ == MAP_FAILED or
+        sqes_ == MAP_FAILED) {
+      release();
+      return;
+    }
+
+    char *sq = static_cast<char *>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    char *cq = static_cast<char *>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // registering the buffers saves pinning them on each read, but may fail
+    // when the locked memory limit is low: plain reads are used then
+    buffers_.resize(DEPTH * CHUNK_SIZE);
+    iovec iovecs[DEPTH];
+    for (unsigned i = 0; i < DEPTH; ++i) {
+      iovecs[i].iov_base = &buffers_[i * CHUNK_SIZE];
+      iovecs[i].iov_len = CHUNK_SIZE;
+    }
+    fixed_ = ::syscall(SYS_io_uring_register, ring_, IORING_REGISTER_BUFFERS,
+                       iovecs, DEPTH) == 0;
+  }
+
+  ~UringReader() { release(); }
+
+  bool ready() const { return ring_ >= 0; }
+
+  void read(std::vector<boost::filesystem::path> const &paths,
+            ReadConsumer &consumer, size_t limit) {
+    if (not ready()) {
+      for (size_t index = 0; index < paths.size(); ++index)
+        consumer.done(index, false);
+      return;
+    }
+    std::vector<unsigned> free_slots;
+    for (unsigned slot = DEPTH; slot > 0; --slot)
+      free_slots.push_back(slot - 1);
+
+    size_t next = 0;
+    while (next < paths.size() or free_slots.size() < DEPTH) {
+      for (; next < paths.size() and not free_slots.empty(); ++next) {
+        unsigned const slot = free_slots.back();
+        free_slots.pop_back();
+        slots_[slot].index = next;
+        slots_[slot].fd = -1;
+        slots_[slot].offset = 0;
+        slots_[slot].failed = false;
+        slots_[slot].closing = false;
+        io_uring_sqe &sqe = prepare(slot, open_operation);
+        sqe.opcode = IORING_OP_OPENAT;
+        sqe.fd = AT_FDCWD;
+        sqe.addr = reinterpret_cast<unsigned long>(paths[next].c_str());
+        sqe.open_flags = O_RDONLY | O_CLOEXEC;
+      }
+
+      if (not submit())
+        return abort(paths, next, free_slots, consumer);
+
+      unsigned head = *cq_head_;
+      unsigned const tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+      for (; head != tail; ++head) {
+        io_uring_cqe const &cqe = cqes_[head & *cq_mask_];
+        unsigned const slot = cqe.user_data & 0xffffffff;
+        Slot &current = slots_[slot];
+        switch (cqe.user_data >> 32) {
+        case open_operation:
+          if (cqe.res < 0) {
+            consumer.done(current.index, false);
+            free_slots.push_back(slot);
+          } else {
+            current.fd = cqe.res;
+            struct stat st;
+            if (::fstat(current.fd, &st) == 0)
+              consumer.identity(current.index, st.st_dev, st.st_ino);
+            read_next(slot, limit);
+          }
+          break;
+        case read_operation:
+          if (cqe.res == -EINTR or cqe.res == -EAGAIN)
+            read_next(slot, limit);
+          else if (cqe.res > 0) {
+            bool const more =
+                consumer.data(current.index, buffer(slot), cqe.res);
+            current.offset += cqe.res;
+            if (not more or (limit and current.offset >= limit))
+              close_file(slot, consumer);
+            else
+              read_next(slot, limit);
+          } else {
+            current.failed = cqe.res < 0;
+            close_file(slot, consumer);
+          }
+          break;
+        case close_operation:
+          free_slots.push_back(slot);
+          break;
+        }
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+  }
+
+private:
+  char *buffer(unsigned slot) { return &buffers_[slot * CHUNK_SIZE]; }
+
+  /* give up the batch after a submission failed: the completions already
+   * posted are drained, the files still open are closed, the ones not done
+   * with are reported as failed, and the ring is dropped, as its state is
+   * unknown */
+  void abort(std::vector<boost::filesystem::path> const &paths, size_t next,
+             std::vector<unsigned> const &free_slots, ReadConsumer &consumer) {
+    std::vector<bool> busy(DEPTH, true);
+    for (size_t i = 0; i < free_slots.size(); ++i)
+      busy[free_slots[i]] = false;
+
+    // the closes the kernel did not consume are done here
+    std::vector<bool> unsent_close(DEPTH, false);
+    unsigned const end = *sq_tail_ + prepared_;
+    for (unsigned index = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+         index != end; ++index) {
+      __u64 const user_data = sqes_[index & *sq_mask_].user_data;
+      if (user_data >> 32 == close_operation)
+        unsent_close[user_data & 0xffffffff] = true;
+    }
+
+    unsigned head = *cq_head_;
+    unsigned const tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+      io_uring_cqe const &cqe = cqes_[head & *cq_mask_];
+      unsigned const slot = cqe.user_data & 0xffffffff;
+      switch (cqe.user_data >> 32) {
+      case open_operation:
+        if (cqe.res >= 0)
+          slots_[slot].fd = cqe.res;
+        else if (not slots_[slot].closing) {
+          slots_[slot].closing = true;
+          consumer.done(slots_[slot].index, false);
+        }
+        break;
+      case close_operation:
+        busy[slot] = false;
+        break;
+      }
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+    for (unsigned slot = 0; slot < DEPTH; ++slot) {
+      Slot const &current = slots_[slot];
+      if (not busy[slot])
+        continue;
+      // a close in flight is left to the kernel
+      if (current.closing) {
+        if (unsent_close[slot])
+          ::close(current.fd);
+        continue;
+      }
+      if (current.fd >= 0)
+        ::close(current.fd);
+      consumer.done(current.index, false);
+    }
+    for (; next < paths.size(); ++next)
+      consumer.done(next, false);
+
+    prepared_ = 0;
+    release();
+  }
+
+  /* the opcodes used here appeared in Linux 5.6 */
+  bool supported() const {
+    static const unsigned OPS = 256;
+    std::vector<char> storage(sizeof(io_uring_probe) +
+                              OPS * sizeof(io_uring_probe_op));
+    io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(&storage[0]);
+    if (::syscall(SYS_io_uring_register, ring_, IORING_REGISTER_PROBE, probe,
+                  OPS) < 0)
+      return false;
+    unsigned const ops[] = { IORING_OP_OPENAT, IORING_OP_READ,
+                             IORING_OP_READ_FIXED, IORING_OP_CLOSE };
+    for (size_t i = 0; i < sizeof(ops) / sizeof(*ops); ++i) {
+      if (ops[i] > probe->last_op or
+          not(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+        return false;
+    }
+    return true;
+  }
+
+  /* reserve the next submission entry, identified by ``slot'' and
+   * ``operation'' on completion */
+  io_uring_sqe &prepare(unsigned slot, operation_type operation) {
+    unsigned const index = (*sq_tail_ + prepared_) & *sq_mask_;
+    io_uring_sqe &sqe = sqes_[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.user_data = (static_cast<__u64>(operation) << 32) | slot;
+    sq_array_[index] = index;
+    // the entry is filled by the caller before submit() publishes it
+    ++prepared_;
+    return sqe;
+  }
+
+  void read_next(unsigned slot, size_t limit) {
+    Slot const &current = slots_[slot];
+    io_uring_sqe &sqe = prepare(slot, read_operation);
+    sqe.opcode = fixed_ ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe.fd = current.fd;
+    sqe.addr = reinterpret_cast<unsigned long>(buffer(slot));
+    sqe.len = limit ? std::min(size_t(CHUNK_SIZE), limit - current.offset)
+                    : CHUNK_SIZE;
+    sqe.off = current.offset;
+    sqe.buf_index = fixed_ ? slot : 0;
+  }
+
+  void close_file(unsigned slot, ReadConsumer &consumer) {
+    Slot &current = slots_[slot];
+    current.closing = true;
+    consumer.done(current.index, not current.failed);
+    io_uring_sqe &sqe = prepare(slot, close_operation);
+    sqe.opcode = IORING_OP_CLOSE;
+    sqe.fd = current.fd;
+  }
+
+  /* publish the prepared entries, submit all the entries not consumed by the
+   * kernel yet and wait for at least one completion */
+  bool submit() {
+    unsigned const tail = *sq_tail_ + prepared_;
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+    prepared_ = 0;
+    for (;;) {
+      unsigned const pending =
+          tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+      long const status =
+          ::syscall(SYS_io_uring_enter, ring_, pending, 1,
+                    IORING_ENTER_GETEVENTS, 0, 0);
+      if (status >= 0)
+        return true;
+      if (errno != EINTR) {
+        logging::log(logging::error) << "io_uring_enter failed: "
+                                     << std::strerror(errno) << std::endl;
+        return false;
+      }
+    }
+  }
+
+  void release() {
+    if (sqes_ != MAP_FAILED)
+      ::munmap(sqes_, sqes_size_);
+    if (cq_ring_ != MAP_FAILED and cq_ring_ != sq_ring_)
+      ::munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != MAP_FAILED)
+      ::munmap(sq_ring_, sq_ring_size_);
+    if (ring_ >= 0)
+      ::close(ring_);
+    ring_ = -1;
+  }
+};
+}
+#endif
+
+std::auto_ptr<BatchReader> BatchReader::create() {
+#if BINMAP_IO_URING
+  std::auto_ptr<UringReader> reader(new UringReader());
+  if (reader->ready())
+    return std::auto_ptr<BatchReader>(reader.release());
+#endif
+  return std::auto_ptr<BatchReader>();
+}
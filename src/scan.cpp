@@ -20,198 +20,827 @@
 #include "binmap/log.hpp"
 #include "binmap/hash.hpp"
 #include "binmap/env.hpp"
+#include "binmap/stat_cache.hpp"
+#include "binmap/walker.hpp"
+#include "binmap/queue.hpp"
+#include "binmap/reader.hpp"
+#include "binmap/file_content.hpp"
+#include "binmap/path_table.hpp"
+#include "binmap/graph_builder.hpp"
 
 #include "binmap/collector.hpp"
 
 #include <vector>
 #include <set>
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
 #include <sstream>
-#include <fstream>
 
-#include <cassert>
 #include <cstdio>
 
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
 
-#include <boost/archive/text_oarchive.hpp>
+
+// one thread walks, one classifies when there are enough of them, the others
+// mostly parse
+StageJobs::StageJobs(int jobs)
+    : walk(1), classify(jobs >= 4 ? 1 : 0),
+      hash(jobs >= 3 ? std::max(1, (jobs - 2) / 4) : 0), parse(0) {
+  parse = std::max(0, jobs - walk - classify - hash);
+}
+
+StageJobs::StageJobs(int walk, int classify, int hash, int parse)
+    : walk(walk), classify(classify), hash(hash), parse(parse) {}
+
+int StageJobs::operator[](int stage) const {
+  int const jobs[] = { walk, classify, hash, parse };
+  return jobs[stage];
+}
+
+int StageJobs::total() const {
+  return std::max(1, walk + classify + hash + parse);
+}
+
+// threads beyond the requested ones, if any, parse
+int StageJobs::stage_of(int thread) const {
+  int stage = 0;
+  for (int end = walk; stage < 3 and thread >= end; end += (*this)[++stage])
+    ;
+  return stage;
+}
+
+namespace {
+/* Everything needed to insert a filesystem entry in the graph.
+ *
+ * Entries are computed concurrently during the exploration, and added to a
+ * GraphBuilder by the thread that completes them. The builder merges them in
+ * the graph once the exploration is over, in an order that does not depend
+ * on the scheduling of the exploration.
+ */
+struct Entry {
+  enum kind_type { directory, symlink, special, file, unhandled };
+
+  kind_type kind;
+  std::vector<DirectoryItem> children; // directory content or link target
+  Hash hash;
+  std::set<boost::filesystem::path> deps;
+  boost::shared_ptr<MetadataInfo const> metadata; // null if not collected, may
+                                                 // be shared by identical files
+  std::string error; // set if the collector failed to process the file
+  FileStat stat;
+  bool has_stat; // only set for regular files, when scanning incrementally
+
+  Entry() : kind(unhandled), has_stat(false) {}
+};
+}
 
 class Scanner {
 
+  typedef std::pair<boost::uint64_t, boost::uint64_t> file_id;
+  typedef boost::unordered_map<file_id, Hash> file_hashes_type;
+  typedef boost::unordered_map<std::string, std::set<boost::filesystem::path> >
+      shared_deps_type;
+  typedef boost::unordered_map<std::string,
+                               boost::shared_ptr<MetadataInfo const> >
+      shared_metadata_type;
+
   BlobMap blobmap_;
   time_t now_;
-  boost::unordered_set<boost::filesystem::path> visited_;
+  StageJobs jobs_;
+  bool incremental_;
+  bool stats_;
+  StatCache stat_cache_;
+  boost::unordered_set<path_id> explored_;
+  GraphBuilder builder_;
+  // analyses shared by identical files, filled during the exploration
+  mutable file_hashes_type file_hashes_;
+  mutable shared_deps_type shared_deps_;
+  mutable shared_metadata_type shared_metadata_;
 
   Scanner(Scanner const &);
 
 public:
   Scanner(boost::filesystem::path const &archive_path,
           std::vector<boost::filesystem::path> const &blacklist =
-              std::vector<boost::filesystem::path>())
-      : blobmap_(archive_path), now_(0), visited_(blacklist.begin(), blacklist.end()) {
+              std::vector<boost::filesystem::path>(),
+          StageJobs const &jobs = StageJobs(), bool incremental = false,
+          bool stats = false)
+      : blobmap_(archive_path), now_(0), jobs_(jobs),
+        incremental_(incremental), stats_(stats),
+        pending_(0), batch_read_(false) {
+    BOOST_FOREACH(boost::filesystem::path const &path, blacklist)
+      explored_.insert(PathTable::get().intern(path));
+    for (int stage = 0; stage < STAGE_COUNT; ++stage)
+      queues_[stage].reset(
+          stage == walk_stage
+              ? new Queue<task_ptr>(0, &signal_)
+              : stage == classify_stage
+                    ? new Queue<task_ptr>(QUEUE_CAPACITY, &signal_)
+                    : new Queue<task_ptr>(CONTENT_QUEUE_CAPACITY, &signal_,
+                                          CONTENT_QUEUE_BYTES));
+  }
+
+  BlobMap &blobmap() { return blobmap_; }
+
+  /* select the algorithm named ``name'' to hash the files, or the one of the
+   * database if empty. All the hashes of a database must use the same one:
+   * returns false if it already uses another one */
+  bool hash_algorithm(std::string const &name) {
+    hash_algorithm_type algorithm = blobmap_.hash_algorithm();
+    if (not name.empty() and not parse_hash_algorithm(name, algorithm)) {
+      logging::log(logging::error) << "unknown hash algorithm: " << name
+                                   << std::endl;
+      return false;
+    }
+    if (algorithm != blobmap_.hash_algorithm() and not blobmap_.empty()) {
+      logging::log(logging::error)
+          << "the database hashes files with "
+          << hash_algorithm_name(blobmap_.hash_algorithm()) << ", not "
+          << name << std::endl;
+      return false;
+    }
+    blobmap_.hash_algorithm(algorithm);
+    return true;
+  }
+
+  void operator()(std::vector<boost::filesystem::path> const &inputs) {
+    /* explore the file hierarchy using ``jobs_'' threads, then build the
+     * graph out of what they found */
+    explore(inputs);
+    builder_.merge(current_graph(), blobmap_.hash_algorithm());
+
+    /* the analysis results of this scan supersede the previous ones */
+    if (incremental_)
+      blobmap_.stat_cache().swap(stat_cache_);
+  }
+
+private:
+  /* A path being explored, as it goes through the stages of the pipeline */
+  struct Task {
+    DirectoryItem item;
+    boost::shared_ptr<Entry> entry;
+    boost::filesystem::file_status status; // set by the walk stage
+    std::string header; // first bytes of the file, set by the classify stage
+    bool has_header; // set if the header has been read along other files
+    // content of a regular file a collector may handle, read once by the
+    // classify stage, or on demand if it is large, and handed over to the
+    // hash and to the collector
+    boost::shared_ptr<FileContent const> content;
+    bool has_deps; // set by the hash stage if an identical file was analysed
+    bool completed; // set once the task went through complete()
+
+    explicit Task(DirectoryItem const &item)
+        : item(item), entry(new Entry()), has_header(false), has_deps(false),
+          completed(false) {}
+  };
+  typedef boost::shared_ptr<Task> task_ptr;
+
+  /* The exploration is split in stages, each one feeding the next through a
+   * bounded queue:
+   * - walk lists directories and determines the type of each path,
+   * - classify reads the first bytes of files, and the rest of the ones a
+   *   collector may handle unless they are large: those are read on demand
+   *   by the next stages,
+   * - hash computes the hash of the content and looks for an identical file,
+   * - parse runs the collector on the content read by the classify stage, it
+   *   also resolves the dependencies.
+   * The paths discovered along the way are fed back to the walk stage, whose
+   * queue is unbounded. Each completed entry is added to the GraphBuilder
+   * right away, its edges to a buffer of the thread that completes it, and
+   * dropped.
+   */
+  enum stage_type { walk_stage, classify_stage, hash_stage, parse_stage };
+  static const int STAGE_COUNT = parse_stage + 1;
+  static const size_t QUEUE_CAPACITY = 1024;
+  // the queues of the tasks that carry the content of a file hold less, and
+  // are bounded by the bytes held in memory too
+  static const size_t CONTENT_QUEUE_CAPACITY = 64;
+  static const size_t CONTENT_QUEUE_BYTES = 16 << 20;
+  // number of files whose header the classify stage reads at once, when a
+  // BatchReader is available
+  static const size_t READ_BATCH = 64;
+
+  static char const *stage_name(int stage) {
+    static char const *names[STAGE_COUNT] = { "walk", "classify", "hash",
+                                              "parse" };
+    return names[stage];
+  }
+
+  // notified of each task pushed and each path done with, idle threads wait
+  // on it
+  Signal signal_;
+  // input queue of each stage
+  boost::scoped_ptr<Queue<task_ptr> > queues_[STAGE_COUNT];
+  // number of paths pushed to the walk stage and not done with
+  long pending_;
+  // readers not in use, created on demand
+  std::vector<boost::shared_ptr<BatchReader> > readers_;
+  bool batch_read_;
+
+  Queue<task_ptr> &queue(int stage) { return *queues_[stage]; }
+
+  /* explore ``inputs'' and everything they reference, using a team of threads
+   * dispatched among the stages */
+  void explore(std::vector<boost::filesystem::path> const &inputs) {
+    boost::shared_ptr<BatchReader> reader = acquire_reader();
+    batch_read_ = reader.get() != 0;
+    if (batch_read_)
+      release_reader(reader);
+
+    // the metadata it brings cannot be read while the graph is being built
+    if (incremental_)
+      blobmap_.load_stat_cache();
+
+#pragma omp parallel num_threads(jobs_.total())
+    {
+      int thread = 0;
+#ifdef _OPENMP
+      thread = omp_get_thread_num();
+#endif
+      // handed over to the builder when the thread is done
+      GraphBuilder::Buffer edges(builder_);
+      // the threads only start once there is something to explore
+#pragma omp single
+      BOOST_FOREACH(boost::filesystem::path const & input, inputs)
+        push(walk_stage, task_ptr(new Task(DirectoryItem(input))), edges);
+      work(jobs_.stage_of(thread), edges);
+    }
+
+    if (stats_) {
+      logging::log(logging::info) << "scan pipeline statistics:" << std::endl;
+      for (int stage = 0; stage < STAGE_COUNT; ++stage)
+        logging::log(logging::info) << "  " << stage_name(stage) << " ("
+                                    << jobs_[stage] << " threads): "
+                                    << queue(stage).stats() << std::endl;
+    }
+  }
+
+  /* process the tasks of ``stage'' until the exploration is over, helping the
+   * other stages, downstream first, when there is nothing to do */
+  void work(int stage, GraphBuilder::Buffer &edges) {
+    for (;;) {
+      unsigned long const generation = signal_.generation();
+      if (done())
+        return;
+      if (not help(stage, edges))
+        signal_.wait(generation);
+    }
+  }
+
+  /* process one task of ``stage'', or of another stage if there is none.
+   * Returns false if there was nothing to do */
+  bool help(int stage, GraphBuilder::Buffer &edges) {
+    bool busy = step(stage, edges);
+    for (int other = STAGE_COUNT - 1; other >= 0 and not busy; --other)
+      busy = other != stage and step(other, edges);
+    return busy;
+  }
+
+  bool done() {
+    long pending;
+#pragma omp critical(scanner_)
+    pending = pending_;
+    return pending == 0;
   }
 
-  BlobMap const &blobmap() { return blobmap_; }
+  /* process one task of ``stage'', or a batch of them if their files can be
+   * read at once. Returns false if there is none */
+  bool step(int stage, GraphBuilder::Buffer &edges) {
+    bool const batch = batch_read_ and stage == classify_stage;
+    std::vector<task_ptr> tasks;
+    task_ptr task;
+    while (tasks.size() < (batch ? READ_BATCH : 1) and
+           queue(stage).try_pop(task))
+      tasks.push_back(task);
+    if (tasks.empty())
+      return false;
+    if (batch)
+      read_files(tasks);
+    BOOST_FOREACH(task_ptr const & task, tasks)
+      run(stage, task, edges);
+    return true;
+  }
 
-  bool operator()(boost::filesystem::path const &input_file) {
-    Graph &graph = current_graph();
-    if (visited_.find(input_file) == visited_.end()) {
+  void run(int stage, task_ptr const &task, GraphBuilder::Buffer &edges) {
+    try {
+      switch (stage) {
+      case walk_stage:
+        walk(task, edges);
+        break;
+      case classify_stage:
+        classify(task, edges);
+        break;
+      case hash_stage:
+        hash(task, edges);
+        break;
+      case parse_stage:
+        parse(task, edges);
+        break;
+      }
+    }
+    catch (std::exception const &e) {
+      logging::log(logging::warning) << "failed to analyse " << task->item.path
+                                     << " (error was:" << e.what() << ')'
+                                     << std::endl;
+      // the error may come from the exploration of the paths it references,
+      // the task itself must be accounted for only once
+      if (not task->completed) {
+        task->entry.reset(new Entry());
+        complete(task, edges);
+      }
+    }
+  }
 
-      visited_.insert(input_file);
+  boost::shared_ptr<BatchReader> acquire_reader() {
+    boost::shared_ptr<BatchReader> reader;
+#pragma omp critical(scanner_)
+    if (not readers_.empty()) {
+      reader = readers_.back();
+      readers_.pop_back();
+    }
+    if (not reader)
+      reader.reset(BatchReader::create().release());
+    return reader;
+  }
+
+  // a reader that failed is dropped
+  void release_reader(boost::shared_ptr<BatchReader> const &reader) {
+    if (not reader->ready())
+      return;
+#pragma omp critical(scanner_)
+    readers_.push_back(reader);
+  }
+
+  /* Collects the headers of the files read by a BatchReader. The classify
+   * stage reads the rest of the files a collector may handle on its own, so
+   * that a batch only holds their first bytes */
+  struct HeaderReader : ReadConsumer {
+    std::vector<task_ptr> tasks;
+
+    void add(task_ptr const &task) {
+      tasks.push_back(task);
+      task->header.clear();
+    }
+
+    bool data(size_t index, char const *bytes, size_t size) {
+      std::string &header = tasks[index]->header;
+      header.append(bytes, std::min(size, Collector::HEADER_SIZE -
+                                              header.size()));
+      return header.size() < Collector::HEADER_SIZE;
+    }
+
+    void done(size_t index, bool ok) {
+      Task &task = *tasks[index];
+      task.has_header = ok;
+      if (not ok)
+        task.header.clear();
+    }
+
+    void identity(size_t index, boost::uint64_t device, boost::uint64_t inode) {
+      DirectoryItem &item = tasks[index]->item;
+      if (item.inode == 0) {
+        item.device = device;
+        item.inode = inode;
+      }
+    }
+  };
+
+  /* read the headers of the regular files of ``tasks'' at once. The files
+   * that fail are handled one by one later on */
+  void read_files(std::vector<task_ptr> const &tasks) {
+    boost::shared_ptr<BatchReader> reader = acquire_reader();
+    if (not reader)
+      return;
+    HeaderReader consumer;
+    std::vector<boost::filesystem::path> paths;
+    BOOST_FOREACH(task_ptr const & task, tasks) {
+      if (task->status.type() != boost::filesystem::regular_file)
+        continue;
+      consumer.add(task);
+      paths.push_back(task->item.path);
+    }
+    reader->read(paths, consumer, Collector::HEADER_SIZE);
+    release_reader(reader);
+  }
+
+  /* hand ``task'' over to ``stage''. While its queue is full, the tasks of
+   * that stage are processed in place: this is the backpressure */
+  void push(int stage, task_ptr const &task, GraphBuilder::Buffer &edges) {
+    if (stage == walk_stage) {
+#pragma omp critical(scanner_)
+      ++pending_;
+    }
+    // a full queue that cannot be stepped has just been emptied
+    while (not queue(stage).try_push(task, weight(*task)))
+      step(stage, edges);
+  }
+
+  // bytes of the file content held in memory by ``task''
+  static size_t weight(Task const &task) {
+    return task.header.size() + (task.content ? task.content->size() : 0);
+  }
+
+  /* add the Entry of ``task'' to the graph and explore the paths it
+   * references */
+  void complete(task_ptr const &task, GraphBuilder::Buffer &edges) {
+    task->completed = true;
+    Entry const &entry = *task->entry;
+    insert(task->item.path, entry, edges);
+    BOOST_FOREACH(DirectoryItem const & child, entry.children)
+      push(walk_stage, task_ptr(new Task(child)), edges);
+    BOOST_FOREACH(boost::filesystem::path const & dep, entry.deps)
+      push(walk_stage, task_ptr(new Task(DirectoryItem(dep))), edges);
+    retire();
+  }
+
+  void retire() {
+#pragma omp critical(scanner_)
+    --pending_;
+    signal_.notify();
+  }
+
+  /* walk stage: skip paths already explored, and handle everything but files.
+   * The type found while listing the parent directory is used when
+   * available, to save a stat */
+  void walk(task_ptr const &task, GraphBuilder::Buffer &edges) {
+    boost::filesystem::path const &input_file = task->item.path;
+    path_id const id = PathTable::get().intern(input_file);
+    bool fresh;
+#pragma omp critical(scanner_)
+    fresh = explored_.insert(id).second;
+    if (not fresh) {
+      retire();
+      return;
+    }
+
+    Entry &entry = *task->entry;
+    boost::filesystem::file_status status = task->item.status;
+    if (status.type() == boost::filesystem::status_unknown) {
+      boost::system::error_code ec;
+      status = boost::filesystem::symlink_status(input_file, ec);
+    }
 
-      if (boost::filesystem::is_directory(input_file)) {
-        /* avoid infinite recursion */
-        if (boost::filesystem::is_symlink(input_file)) {
+    switch (status.type()) {
+    /* recurse through directories */
+    case boost::filesystem::directory_file:
+      entry.kind = Entry::directory;
+      list_directory(entry.children, input_file, incremental_);
+      return complete(task, edges);
+    case boost::filesystem::symlink_file: {
+      boost::system::error_code ec;
+      boost::filesystem::file_status const target =
+          boost::filesystem::status(input_file, ec);
+      /* avoid infinite recursion */
+      if (boost::filesystem::is_directory(target)) {
+        entry.kind = Entry::symlink;
+        std::auto_ptr<Collector> collector =
+            Collector::get_collector(input_file, status);
+        if (collector.get()) {
           std::set<boost::filesystem::path> deps;
-          std::auto_ptr<Collector> collector =
-              Collector::get_collector(input_file);
-          if (collector.get()) {
-            (*collector)(deps);
-            if (deps.size() == 0)
-              assert(deps.size() == 1);
-            (*this)(*deps.begin());
-          }
+          (*collector)(deps);
+          if (deps.empty())
+            logging::log(logging::warning) << "skipping unresolved symlink: "
+                                           << input_file << std::endl;
+          else
+            entry.children.push_back(DirectoryItem(*deps.begin()));
+        }
+        return complete(task, edges);
+      }
+      if (boost::filesystem::is_other(target)) {
+        entry.kind = Entry::special;
+        return complete(task, edges);
+      }
+      break;
+    }
+    case boost::filesystem::regular_file:
+    case boost::filesystem::file_not_found:
+      break;
+    /* leave the entry unhandled */
+    case boost::filesystem::status_error:
+      return complete(task, edges);
+    default:
+      entry.kind = Entry::special;
+      return complete(task, edges);
+    }
+
+    task->status = status;
+    /* reuse the previous scan if the file did not change */
+    if (incremental_) {
+      if (task->item.has_stat) {
+        entry.stat = task->item.stat;
+        entry.has_stat = true;
+      }
+      else
+        entry.has_stat = entry.stat.read(input_file);
+      if (entry.has_stat and reuse(input_file, entry))
+        return complete(task, edges);
+    }
+    push(classify_stage, task, edges);
+  }
+
+  /* classify stage: skip the files no collector may handle, read the others
+   * once for the hash and the collector */
+  void classify(task_ptr const &task, GraphBuilder::Buffer &edges) {
+    // only regular files are hashed before being parsed
+    if (task->status.type() != boost::filesystem::regular_file)
+      return push(parse_stage, task, edges);
+    boost::shared_ptr<FileContent> content;
+    if (not task->has_header) {
+      content.reset(new FileContent(task->item.path, Collector::HEADER_SIZE));
+      if (content->good())
+        task->header.assign(content->data(), content->size());
+      // the hard links to a file hashed already are not hashed again
+      if (task->item.inode == 0) {
+        task->item.device = content->device();
+        task->item.inode = content->inode();
+      }
+    }
+    // a file no collector may handle is not worth reading further
+    if (not Collector::may_handle(task->status, task->header))
+      return complete(task, edges);
+    // the header of a file read along other files is all there is so far
+    if (not content)
+      content.reset(new FileContent(task->item.path));
+    if (content->complete())
+      task->content = content;
+    push(hash_stage, task, edges);
+  }
+
+  /* hash stage: reuse the analysis of an identical file if possible */
+  void hash(task_ptr const &task, GraphBuilder::Buffer &edges) {
+    boost::filesystem::path const &input_file = task->item.path;
+    Entry &entry = *task->entry;
+    if (not known_hash(task->item, entry.hash)) {
+      Hasher hasher(blobmap_.hash_algorithm());
+      if (task->content)
+        hasher.update(*task->content);
+      entry.hash = hasher.digest();
+      remember_hash(task->item, entry.hash);
+    }
+    task->has_deps = reuse_deps(input_file, entry);
+    reuse_metadata(input_file, entry);
+    if (task->has_deps and entry.metadata) {
+      entry.kind = Entry::file;
+      logging::log(logging::info) << "reusing analysis of identical file: "
+                                  << input_file << " " << entry.hash
+                                  << std::endl;
+      return complete(task, edges);
+    }
+    push(parse_stage, task, edges);
+  }
+
+  /* parse stage: run the collector, this is where the costly operations
+   * happen */
+  void parse(task_ptr const &task, GraphBuilder::Buffer &edges) {
+    boost::filesystem::path const &input_file = task->item.path;
+    Entry &entry = *task->entry;
+    bool const regular =
+        task->status.type() == boost::filesystem::regular_file;
+    // the collector, and the parsed binary it holds, does not outlive this
+    // call: only the dependencies and the metadata are kept
+    std::auto_ptr<Collector> collector =
+        Collector::get_collector(input_file, task->status, task->content);
+    if (collector.get()) {
+      entry.kind = Entry::file;
+      if (not regular)
+        entry.hash = Hash(input_file, blobmap_.hash_algorithm());
+      logging::log(logging::info) << "analysing file: " << input_file << " "
+                                  << entry.hash << std::endl;
+      if (not task->has_deps) {
+        try {
+          (*collector)(entry.deps);
         }
-        /* recurse through directories */
-        else {
-          logging::log(logging::info) << "walking directory: " << input_file
-                                      << std::endl;
-          boost::system::error_code ec;
-          std::vector<boost::filesystem::path> children;
-          for (boost::filesystem::directory_iterator node(input_file, ec), end;
-               node != end; node.increment(ec)) {
-            if (not ec)
-              children.push_back(node->path());
-          }
-          BOOST_FOREACH(boost::filesystem::path const & child, children) {
-            if(! (*this)(child) )
-            {
-              logging::log(logging::warning) << "skipping entry '"
-                                             << child.string()
-                                             << std::endl; // TODO: native() vs.
-                                                           // string on windows
-            }
-          }
+        catch (std::exception const &e) {
+          // this happen when the collector is_valid returns true but raises an
+          // error during its processing
+          entry.deps.clear();
+          entry.error = e.what();
+          return complete(task, edges);
         }
-      } else if (boost::filesystem::is_other(input_file)) {
-        logging::log(logging::warning) << "skipping special file: " << input_file
-                                       << std::endl;
-        /* just skip */
+        if (regular)
+          share_deps(input_file, entry, collector->relocatable());
       }
-      /* analyse file */
-      else {
-        std::auto_ptr<Collector> collector = Collector::get_collector(input_file);
-        if (collector.get()) {
-          Hash input_hash(input_file);
-
-
-          boost::filesystem::path path_to_add = add_node(input_file, input_hash);
-
-	  if (path_to_add == input_file || visited_.find(path_to_add) == visited_.end()) {
-		visited_.insert(path_to_add);
-
-		std::set<boost::filesystem::path> deps;
-		try {
-			logging::log(logging::info) << "analysing file: " << path_to_add << " "
-						<< input_hash << std::endl;
-			analyze_dependencies(*collector, deps);
-			analyze_metadata(*collector, input_hash);
-			add_deps(path_to_add, deps);
-			logging::log(logging::info) << " done for " << path_to_add <<"\n" << std::endl;
-		}
-		catch (std::exception const &e) {
-			// this happen when the collector is_valid returns true but raises an
-			// error during its processing
-			logging::log(logging::warning) << "bad format: skipping "
-						   << input_file
-						   << " (error was:" << e.what() << ')'
-						   << std::endl;
-			// still write dummy metadata for consistency
-			blobmap_.metadata()->insert(MetadataInfo(input_hash));
-		}
-	  }
-
-        } else {
-          logging::log(logging::warning) << "skipping unhandled file: "
-                                         << input_file << std::endl;
-          return false;
+      if (not entry.metadata) {
+        try {
+          boost::shared_ptr<MetadataInfo> metadata(new MetadataInfo(entry.hash));
+          (*collector)(*metadata);
+          entry.metadata = metadata;
+          if (regular)
+            share_metadata(input_file, entry);
+        }
+        catch (...) {
+          /* should log something */
         }
       }
-    } else if (not graph.has_node(trim_root(input_file))) {
-      // the node has already been visited, but for some reason, it has not been
-      // registered
-      // most probably it was faulty
-      // so rethrow exception
     }
-    return true;
+    complete(task, edges);
   }
 
-private:
-  Graph const &current_graph() const {
-    if (now_ == 0) {
-      throw std::runtime_error("no generated graph");
+  /* set ``hash'' if a hard link to ``item'' has already been hashed. The
+   * items get their identity from the walker when it stat'ed them, from the
+   * classify stage otherwise, the ones it could not open have none */
+  bool known_hash(DirectoryItem const &item, Hash &hash) const {
+    if (item.inode == 0)
+      return false;
+    bool found;
+#pragma omp critical(identical_)
+    {
+      file_hashes_type::const_iterator where =
+          file_hashes_.find(file_id(item.device, item.inode));
+      found = where != file_hashes_.end();
+      if (found)
+        hash = where->second;
     }
-    return blobmap_[now_];
+    return found;
   }
 
-  Graph &current_graph() {
-    if (now_ == 0) {
-      do {
-        now_ = time(0);
-        // wait at most 1 sec
-      } while (blobmap_.find(now_) != blobmap_.kend());
-      blobmap_.create(now_);
-    }
-    return blobmap_[now_];
+  void remember_hash(DirectoryItem const &item, Hash const &hash) const {
+    if (item.inode == 0)
+      return;
+#pragma omp critical(identical_)
+    file_hashes_.insert(std::make_pair(file_id(item.device, item.inode), hash));
+  }
+
+  /* The analysis of a file is shared by its identical copies: the dependencies
+   * are keyed by content, plus the directory of the file unless the collector
+   * tells they do not depend on it, the metadata by content and filename,
+   * from which the collectors extract names and versions */
+  static std::string deps_key(boost::filesystem::path const &input_file,
+                              Hash const &hash, bool relocatable) {
+    std::string key(hash.data(), hash.data() + hash.size());
+    if (not relocatable)
+      key += '\0' + input_file.parent_path().string();
+    return key;
   }
 
-  template<class Iterable>
-  void analyze_dependencies(Collector &collector, Iterable &deps) {
-    std::set<boost::filesystem::path> temp_deps;
-    collector(temp_deps);
-    BOOST_FOREACH(boost::filesystem::path const& dep, temp_deps) {
-      (*this)(dep);
-      deps.insert(dep);
+  static std::string metadata_key(boost::filesystem::path const &input_file,
+                                  Hash const &hash) {
+    return std::string(hash.data(), hash.data() + hash.size()) + '\0' +
+           input_file.filename().string();
+  }
+
+  /* fill the dependencies of ``entry'' from an identical file, if possible */
+  bool reuse_deps(boost::filesystem::path const &input_file,
+                  Entry &entry) const {
+    bool found = false;
+#pragma omp critical(identical_)
+    {
+      for (int relocatable = 1; relocatable >= 0 and not found; --relocatable) {
+        shared_deps_type::const_iterator where =
+            shared_deps_.find(deps_key(input_file, entry.hash, relocatable));
+        found = where != shared_deps_.end();
+        if (found)
+          entry.deps = where->second;
+      }
     }
+    return found;
   }
 
-  void analyze_metadata(Collector &collector,
-                        Hash const &input_hash) {
-    try {
-      MetadataInfo mi(input_hash);
-      collector(mi);
-      blobmap_.metadata()->insert(mi);
+  void share_deps(boost::filesystem::path const &input_file, Entry const &entry,
+                  bool relocatable) const {
+#pragma omp critical(identical_)
+    shared_deps_.insert(std::make_pair(
+        deps_key(input_file, entry.hash, relocatable), entry.deps));
+  }
+
+  /* fill the metadata of ``entry'' from an identical file, if possible */
+  void reuse_metadata(boost::filesystem::path const &input_file,
+                      Entry &entry) const {
+#pragma omp critical(identical_)
+    {
+      shared_metadata_type::const_iterator where =
+          shared_metadata_.find(metadata_key(input_file, entry.hash));
+      if (where != shared_metadata_.end())
+        entry.metadata = where->second;
     }
-    catch (...) {
-      /* should log something */
+  }
+
+  void share_metadata(boost::filesystem::path const &input_file,
+                      Entry const &entry) const {
+#pragma omp critical(identical_)
+    shared_metadata_.insert(std::make_pair(
+        metadata_key(input_file, entry.hash), entry.metadata));
+  }
+
+  /* fill ``entry'' from the previous scan if ``input_file'' did not change
+   * since then */
+  bool reuse(boost::filesystem::path const &input_file, Entry &entry) const {
+    StatCache::Record const *record =
+        blobmap_.stat_cache().find(input_file, entry.stat);
+    if (not record)
+      return false;
+    if (record->handled) {
+      if (record->has_metadata) {
+        bool found = true;
+#pragma omp critical(metadata_)
+        try {
+          entry.metadata.reset(
+              new MetadataInfo((*blobmap_.metadata())[record->hash]));
+        }
+        catch (std::runtime_error const &) {
+          found = false;
+        }
+        if (not found)
+          return false;
+      }
+      entry.kind = Entry::file;
+      entry.hash = record->hash;
+      entry.deps.insert(record->deps.begin(), record->deps.end());
+      entry.error = record->error;
     }
+    logging::log(logging::info) << "reusing previous analysis of: "
+                                << input_file << std::endl;
+    return true;
   }
 
-  boost::filesystem::path
-  add_node(boost::filesystem::path const &input_file,
-                            Hash const &input_hash) {
-    boost::filesystem::path const trimed_input_file = trim_root(input_file);
-    Graph &graph = current_graph();
-    boost::filesystem::path to_add = graph.add_node(trimed_input_file, input_hash);
-    logging::log(logging::warning) << "adding file: " << to_add << " "
-                                << input_hash << std::endl;
-    return to_add;
+  /* record the analysis of ``input_file'' for the next incremental scan */
+  void remember(boost::filesystem::path const &input_file, Entry const &entry) {
+    StatCache::Record record;
+    record.stat = entry.stat;
+    record.handled = entry.kind == Entry::file;
+    record.hash = entry.hash;
+    record.deps.assign(entry.deps.begin(), entry.deps.end());
+    record.has_metadata = entry.metadata.get() != 0;
+    record.error = entry.error;
+    stat_cache_.insert(input_file, record);
   }
 
-  template<class Iterable>
-  void
-  add_deps(boost::filesystem::path const &input_file,
-                            Iterable const &deps) {
-    boost::filesystem::path const trimed_input_file = trim_root(input_file);
-    Graph &graph = current_graph();
+  /* the stages may read the metadata while they are inserted */
+  void insert_metadata(MetadataInfo const &metadata) {
+#pragma omp critical(metadata_)
+    blobmap_.metadata()->insert(metadata);
+  }
+
+  /* add the Entry of ``input_file'' to the builder, its edges to ``edges'',
+   * and record the rest of its analysis */
+  void insert(boost::filesystem::path const &input_file, Entry const &entry,
+              GraphBuilder::Buffer &edges) {
+    if (entry.has_stat) {
+#pragma omp critical(stat_cache_)
+      remember(input_file, entry);
+    }
 
-    BOOST_FOREACH(typename Iterable::value_type const& dep, deps) {
-      graph.add_edge(trimed_input_file, trim_root(dep));
+    switch (entry.kind) {
+    case Entry::symlink:
+      return;
+    case Entry::directory:
+      logging::log(logging::info) << "walking directory: " << input_file
+                                  << std::endl;
+      return;
+    case Entry::special:
+      logging::log(logging::warning) << "skipping special file: " << input_file
+                                     << std::endl;
+      return;
+    case Entry::unhandled:
+      logging::log(logging::warning) << "skipping unhandled file: "
+                                     << input_file << std::endl;
+      return;
+    case Entry::file:
+      break;
     }
-    logging::log(logging::info) << "adding deps of: " << trimed_input_file << std::endl;
+
+    PathTable &table = PathTable::get();
+    path_id const id = table.intern(trim_root(input_file));
+    builder_.add_node(id, entry.hash);
+    logging::log(logging::warning) << "adding file: " << trim_root(input_file)
+                                   << " " << entry.hash << std::endl;
+    if (not entry.error.empty()) {
+      logging::log(logging::warning) << "bad format: skipping "
+                                     << input_file
+                                     << " (error was:" << entry.error << ')'
+                                     << std::endl;
+      // still write dummy metadata for consistency
+      insert_metadata(MetadataInfo(entry.hash));
+      return;
+    }
+    if (entry.metadata)
+      insert_metadata(*entry.metadata);
+
+    // dependencies that are not scanned are identified by their path
+    std::vector<path_id> deps;
+    deps.reserve(entry.deps.size());
+    BOOST_FOREACH(boost::filesystem::path const & dep, entry.deps)
+      deps.push_back(table.intern(trim_root(dep)));
+    edges.add_edges(id, deps);
+    logging::log(logging::info) << "adding deps of: " << trim_root(input_file)
+                                << std::endl;
+  }
+
+  Graph &current_graph() {
+    if (now_ == 0) {
+      do {
+        now_ = time(0);
+        // wait at most 1 sec
+      } while (blobmap_.find(now_) != blobmap_.kend());
+      blobmap_.create(now_);
+    }
+    return blobmap_[now_];
   }
 
   boost::filesystem::path trim_root(boost::filesystem::path const &path) const {
@@ -242,7 +871,9 @@ void print_blacklist(boost::filesystem::path const& item) {
 int scan(std::vector<boost::filesystem::path> const &paths,
          boost::filesystem::path const &output_path,
          boost::filesystem::path const &root,
-         std::vector<boost::filesystem::path> blacklist/*make a copy for inplace modification*/)
+         std::vector<boost::filesystem::path> blacklist/*make a copy for inplace modification*/,
+         StageJobs const &jobs, bool incremental, bool stats,
+         std::string const &hash_algorithm, bool compress)
 {
   blacklist.push_back("/dev");
   blacklist.push_back("/proc");
@@ -251,19 +882,21 @@ int scan(std::vector<boost::filesystem::path> const &paths,
 
   std::for_each(blacklist.begin(), blacklist.end(), print_blacklist);
 
-  Scanner scanner(output_path, blacklist);
+  Scanner scanner(output_path, blacklist, jobs, incremental, stats);
+  if (not scanner.hash_algorithm(hash_algorithm))
+    return 1;
   Env::initialize_all(root);
 
-  BOOST_FOREACH(boost::filesystem::path const & path, paths) {
-    try {
-      scanner(path);
-    }
-    catch (...) {
-    }
-  }
+  scanner(paths);
 
-  std::ofstream ofs(output_path.string().c_str(), std::ios::binary);
-  boost::archive::text_oarchive oa(ofs);
-  oa& scanner.blobmap();
+  if (compress)
+    scanner.blobmap().codec(database::deflate_codec);
+  try {
+    scanner.blobmap().store(output_path);
+  }
+  catch (std::exception const &e) {
+    logging::log(logging::error) << e.what() << std::endl;
+    return 1;
+  }
   return 0;
 }
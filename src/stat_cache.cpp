@@ -0,0 +1,96 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+#include "binmap/stat_cache.hpp"
+
+#include <boost/filesystem/operations.hpp>
+#include <ciso646>
+
+#ifndef _WIN32
+# include <sys/types.h>
+# include <sys/stat.h>
+#endif
+
+FileStat::FileStat() : device(0), inode(0), size(0), mtime_ns(0), ctime_ns(0) {}
+
+bool FileStat::read(boost::filesystem::path const &path) {
+#ifdef _WIN32
+  // no inode nor change time there, the modification time is good enough
+  boost::system::error_code ec;
+  if (not boost::filesystem::is_regular_file(
+          boost::filesystem::symlink_status(path, ec)) or ec)
+    return false;
+  size = boost::filesystem::file_size(path, ec);
+  mtime_ns = static_cast<boost::uint64_t>(
+                 boost::filesystem::last_write_time(path, ec)) * 1000000000ULL;
+  return not ec;
+#else
+  struct stat st;
+  if (::lstat(path.c_str(), &st) != 0)
+    return false;
+  return read(st);
+#endif
+}
+
+#ifndef _WIN32
+bool FileStat::read(struct stat const &st) {
+  if (not S_ISREG(st.st_mode))
+    return false;
+  device = st.st_dev;
+  inode = st.st_ino;
+  size = st.st_size;
+# if defined(__APPLE__)
+  mtime_ns = st.st_mtimespec.tv_sec * 1000000000ULL + st.st_mtimespec.tv_nsec;
+  ctime_ns = st.st_ctimespec.tv_sec * 1000000000ULL + st.st_ctimespec.tv_nsec;
+# else
+  mtime_ns = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+  ctime_ns = st.st_ctim.tv_sec * 1000000000ULL + st.st_ctim.tv_nsec;
+# endif
+  return true;
+}
+#endif
+
+bool FileStat::operator==(FileStat const &other) const {
+  return device == other.device and inode == other.inode
+     and size == other.size and mtime_ns == other.mtime_ns
+     and ctime_ns == other.ctime_ns;
+}
+
+bool FileStat::operator!=(FileStat const &other) const {
+  return not (*this == other);
+}
+
+StatCache::Record::Record() : handled(false), has_metadata(false) {}
+
+// the record is only valid if the file did not change in between
+StatCache::Record const *
+StatCache::find(boost::filesystem::path const &path,
+                FileStat const &stat) const {
+  boost::unordered_map<boost::filesystem::path, Record>::const_iterator where =
+      records_.find(path);
+  if (where == records_.end() or where->second.stat != stat)
+    return 0;
+  return &where->second;
+}
+
+void StatCache::insert(boost::filesystem::path const &path,
+                       Record const &record) {
+  records_[path] = record;
+}
+
+void StatCache::swap(StatCache &other) { records_.swap(other.records_); }
+
+size_t StatCache::size() const { return records_.size(); }
@@ -21,13 +21,13 @@
 #include <boost/filesystem/operations.hpp>
 
 int view(boost::filesystem::path const &archive_path,
-         boost::filesystem::path const &dot_path)
+         boost::filesystem::path const &dot_path, bool counts)
 {
   if (boost::filesystem::exists(archive_path)) {
     BlobMap bm(archive_path);
     BlobMapView bmv(bm.metadata());
     bm.back(bmv);
-    bmv.dot(dot_path);
+    bmv.graph().dot(dot_path, counts);
     return 0;
   } else {
     logging::log(logging::error) << "input not found: " << archive_path
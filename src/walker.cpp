@@ -0,0 +1,166 @@
+//
+//   Copyright 2014 QuarksLab
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//       http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+//
+
+/* Directory listing
+ *
+ * On Linux, directories are read through getdents64 with a large buffer, and
+ * the few entries whose type is not reported are stat'ed relative to the
+ * directory file descriptor. Elsewhere boost::filesystem is used.
+ */
+#include "binmap/walker.hpp"
+
+#include <cstring>
+#include <ciso646>
+
+#ifdef __linux__
+# include <fcntl.h>
+# include <unistd.h>
+# include <dirent.h>
+# include <sys/stat.h>
+# include <sys/syscall.h>
+#endif
+
+DirectoryItem::DirectoryItem(boost::filesystem::path const &path,
+                             boost::filesystem::file_status const &status)
+    : path(path), status(status), device(0), inode(0), has_stat(false) {}
+
+#ifdef __linux__
+
+namespace {
+
+// layout of the records filled by getdents64, not exposed by the libc
+struct linux_dirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+
+boost::filesystem::file_type from_mode(mode_t mode) {
+  if (S_ISREG(mode))
+    return boost::filesystem::regular_file;
+  if (S_ISDIR(mode))
+    return boost::filesystem::directory_file;
+  if (S_ISLNK(mode))
+    return boost::filesystem::symlink_file;
+  if (S_ISBLK(mode))
+    return boost::filesystem::block_file;
+  if (S_ISCHR(mode))
+    return boost::filesystem::character_file;
+  if (S_ISFIFO(mode))
+    return boost::filesystem::fifo_file;
+  if (S_ISSOCK(mode))
+    return boost::filesystem::socket_file;
+  return boost::filesystem::type_unknown;
+}
+
+boost::filesystem::file_type from_dtype(unsigned char d_type) {
+  switch (d_type) {
+  case DT_REG:
+    return boost::filesystem::regular_file;
+  case DT_DIR:
+    return boost::filesystem::directory_file;
+  case DT_LNK:
+    return boost::filesystem::symlink_file;
+  case DT_BLK:
+    return boost::filesystem::block_file;
+  case DT_CHR:
+    return boost::filesystem::character_file;
+  case DT_FIFO:
+    return boost::filesystem::fifo_file;
+  case DT_SOCK:
+    return boost::filesystem::socket_file;
+  default:
+    return boost::filesystem::status_unknown;
+  }
+}
+}
+
+bool list_directory(std::vector<DirectoryItem> &items,
+                    boost::filesystem::path const &directory, bool with_stat) {
+  int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  static const size_t BUFFER_SIZE = 1 << 16;
+  std::vector<char> buffer(BUFFER_SIZE);
+  long nread;
+  while ((nread = ::syscall(SYS_getdents64, fd, &buffer[0], buffer.size())) > 0) {
+    for (long offset = 0; offset < nread;) {
+      linux_dirent64 const *dirent =
+          reinterpret_cast<linux_dirent64 const *>(&buffer[offset]);
+      offset += dirent->d_reclen;
+
+      char const *name = dirent->d_name;
+      if (std::strcmp(name, ".") == 0 or std::strcmp(name, "..") == 0)
+        continue;
+
+      DirectoryItem item(directory / name,
+                         boost::filesystem::file_status(
+                             from_dtype(dirent->d_type)));
+
+      // only stat when the listing is not enough
+      bool const unknown =
+          item.status.type() == boost::filesystem::status_unknown;
+      bool const regular =
+          item.status.type() == boost::filesystem::regular_file;
+      // the identity of the entry is only known from its own stat: d_ino
+      // is not the inode of a mount point, nor st_dev of the directory its
+      // device
+      if (unknown or (with_stat and regular)) {
+        struct stat st;
+        if (::fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+          item.status = boost::filesystem::file_status(from_mode(st.st_mode));
+          item.device = st.st_dev;
+          item.inode = st.st_ino;
+          if (with_stat and S_ISREG(st.st_mode))
+            item.has_stat = item.stat.read(st);
+        }
+      }
+      items.push_back(item);
+    }
+  }
+  ::close(fd);
+  return nread == 0;
+}
+
+#else
+
+bool list_directory(std::vector<DirectoryItem> &items,
+                    boost::filesystem::path const &directory, bool with_stat) {
+  boost::system::error_code ec;
+  boost::filesystem::directory_iterator node(directory, ec), end;
+  if (ec)
+    return false;
+  for (; node != end; node.increment(ec)) {
+    if (ec)
+      continue;
+    DirectoryItem item(node->path(), node->symlink_status(ec));
+    if (with_stat and
+        item.status.type() == boost::filesystem::regular_file) {
+      item.has_stat = item.stat.read(item.path);
+      if (item.has_stat) {
+        item.device = item.stat.device;
+        item.inode = item.stat.inode;
+      }
+    }
+    items.push_back(item);
+  }
+  return true;
+}
+
+#endif